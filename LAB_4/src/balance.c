@@ -0,0 +1,80 @@
+/**
+ * @file balance.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Programa que pregunta al monitor el saldo de una wallet tras
+ * un bloque y cuántas recompensas cobró en un rango de bloques. El
+ * monitor responde con su histórico de saldos, sin recorrer la cadena.
+ * @version 0.1 - Consultas de saldos históricos.
+ * @date 2021-05-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "monitor.h"
+
+int main(int argc, char *argv[]) {
+    struct mq_attr attributes = {
+        .mq_flags = 0,
+        .mq_maxmsg = 1,
+        .mq_curmsgs = 0,
+        .mq_msgsize = sizeof(balance_reply)
+    };
+    balance_query query;
+    balance_reply reply;
+    struct timespec ts;
+    char name[64];
+    mqd_t queries = (mqd_t)-1, replies = (mqd_t)-1;
+    int status = EXIT_FAILURE;
+
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <WALLET> <ID> [ID_DESDE]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    query.pid = getpid();
+    query.wallet = atoi(argv[1]);
+    query.to = atoi(argv[2]);
+    query.from = argc == 4 ? atoi(argv[3]) : query.to;
+
+    /* Creamos nuestra cola de respuesta antes de preguntar */
+    snprintf(name, sizeof(name), QUERY_REPLY_PREFIX "%d", (int)query.pid);
+    replies = mq_open(name, O_RDONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, &attributes);
+    if (replies == (mqd_t)-1) {
+        perror("mq_open");
+        exit(EXIT_FAILURE);
+    }
+
+    queries = mq_open(MQ_QUERY_NAME, O_WRONLY | O_NONBLOCK);
+    if (queries == (mqd_t)-1) {
+        fprintf(stderr, "El monitor no está atendiendo consultas.\n");
+        mq_close(replies);
+        mq_unlink(name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (mq_send(queries, (const char *)&query, sizeof(balance_query), 0) == -1) {
+        perror("mq_send");
+    } else if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+        perror("clock_gettime");
+    } else {
+        ts.tv_sec += QUERY_TIMEOUT;
+        if (mq_timedreceive(replies, (char *)&reply, sizeof(balance_reply), NULL, &ts) != sizeof(balance_reply)) {
+            fprintf(stderr, "El monitor no ha respondido.\n");
+        } else if (reply.status == QUERY_UNKNOWN) {
+            fprintf(stderr, "El bloque %d es anterior a los que conoce el monitor.\n", reply.from);
+        } else if (reply.status != QUERY_OK) {
+            fprintf(stderr, "Consulta no válida.\n");
+        } else {
+            printf("Wallet %d: saldo %d tras el bloque %d, %d recompensas en los bloques %d-%d.\n",
+                reply.wallet, reply.balance, reply.to, reply.rewards, reply.from, reply.to);
+            status = EXIT_SUCCESS;
+        }
+    }
+
+    mq_close(queries);
+    mq_close(replies);
+    mq_unlink(name);
+
+    exit(status);
+}
@@ -0,0 +1,274 @@
+/**
+ * @file bench.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Programa que mide el rendimiento de la búsqueda de
+ * los trabajadores sin necesidad de levantar una red de mineros.
+ * Mide los hashes por segundo de cada kernel con un hilo, la
+ * escalabilidad del pool de 1 a N hilos y la distribución del
+ * tiempo hasta encontrar la solución de targets aleatorios.
+ * Con -i FICHERO mide también la construcción, el tamaño y las
+ * consultas por segundo del índice inverso. Con -p sha256 mide el
+ * puzzle SHA-256 con la dificultad -d en lugar de simple_hash.
+ * La salida es CSV (o JSON con -j) con una fila por medida:
+ *      test,kernel,threads,stat,value,unit
+ * @version 0.1 - Benchmark de la búsqueda.
+ *          0.2 - Benchmark del índice inverso.
+ *          0.3 - Benchmark de cada puzzle.
+ * @date 2021-05-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <time.h>
+#include <string.h>
+
+#include "trabajador.h"
+#include "hash_index.h"
+#include "pow.h"
+
+static short json = 0;
+static short first_row = 1;
+
+/**
+ * @brief Función que devuelve el tiempo actual en segundos.
+ *
+ * @return double Segundos (reloj monotónico).
+ */
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/**
+ * @brief Función que imprime una medida en el formato elegido.
+ */
+static void print_row(const char *test, const char *kernel, int threads, const char *stat, double value, const char *unit) {
+    if (json == 1) {
+        printf("%s\n  {\"test\": \"%s\", \"kernel\": \"%s\", \"threads\": %d, \"stat\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}",
+            first_row == 1 ? "" : ",", test, kernel, threads, stat, value, unit);
+    } else {
+        printf("%s,%s,%d,%s,%.6g,%s\n", test, kernel, threads, stat, value, unit);
+    }
+    first_row = 0;
+    fflush(stdout);
+}
+
+/**
+ * @brief Función para ordenar doubles con qsort.
+ */
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Función que lanza una ronda en el pool sobre [0, end) y
+ * devuelve lo que ha tardado.
+ *
+ * @param pool Pool de trabajadores.
+ * @param jobs Trabajos (uno por trabajador).
+ * @param sched Planificador compartido.
+ * @param end Fin del dominio.
+ * @param target Hash buscado.
+ * @param solution Donde se guarda la solución (-1 si no se encuentra).
+ * @return double Segundos, -1 si ERR.
+ */
+static double timed_round(worker_pool *pool, worker_struct *jobs, range_scheduler *sched, long int end, long int target, long int *solution) {
+    double t0 = 0;
+
+    atomic_store(&solution_find, 0);
+
+    /* Cada medida recorre el dominio desde cero */
+    sched_forget(sched);
+    if (sched_reset(sched, target, end, DEFAULT_CHUNK) == -1) return -1;
+    for (int i = 0; i < pool->num_workers; i++) {
+        jobs[i].target = target;
+        jobs[i].starting_index = 0;
+        jobs[i].ending_index = end;
+        jobs[i].solution = -1;
+        jobs[i].sched = sched;
+    }
+
+    t0 = now();
+    if (pool_start(pool, jobs) == -1 || pool_wait(pool) == -1) return -1;
+
+    *solution = -1;
+    for (int i = 0; i < pool->num_workers; i++)
+        if (jobs[i].solution != -1) *solution = jobs[i].solution;
+
+    return now() - t0;
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = 0, samples = 50, opt = 0, n_kernels = 0;
+    int puzzle = POW_SIMPLE, difficulty = POW_DEFAULT_DIFFICULTY;
+    const search_kernel *kernels = NULL;
+    const char *best = NULL;
+    char *index_path = NULL;
+    range_scheduler sched;
+
+    while ((opt = getopt(argc, argv, "t:n:ji:p:d:")) != -1) {
+        switch (opt) {
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                break;
+            case 'j':
+                json = 1;
+                break;
+            case 'i':
+                index_path = optarg;
+                break;
+            case 'p':
+                puzzle = pow_find(optarg);
+                break;
+            case 'd':
+                difficulty = atoi(optarg);
+                break;
+            default:
+                puzzle = -1;
+                break;
+        }
+    }
+    if (puzzle == -1 || pow_select(puzzle, difficulty) == -1) {
+        fprintf(stderr, "Usage: %s [-t MAX_HILOS] [-n MUESTRAS] [-j] [-i INDICE] [-p simple|sha256] [-d DIFICULTAD]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (max_threads <= 0) max_threads = workers_available();
+    if (samples <= 0) samples = 1;
+
+    srand(time(NULL));
+    sched_ini(&sched);
+    kernels = pow_get()->kernel_list(&n_kernels);
+    best = pow_get()->kernel_get()->name;
+
+    if (json == 1) printf("[");
+    else printf("test,kernel,threads,stat,value,unit\n");
+
+    /* El candidato PRIME-1 queda fuera de [0, PRIME-1), así que con su
+    hash como target se recorre el rango entero sin encontrar nada.
+    Con SHA-256 medimos un rango más corto con la dificultad máxima,
+    que con 2^22 nonces casi nunca se cumple */
+    long int miss = simple_hash(PRIME-1), span = PRIME-1;
+    if (puzzle == POW_SHA256) {
+        miss = 0;
+        span = 1L << 22;
+        pow_select(puzzle, POW_MAX_DIFFICULTY);
+    }
+
+    /* 1. Hashes por segundo de cada kernel con un solo hilo */
+    for (int k = 0; k < n_kernels; k++) {
+        atomic_store(&solution_find, 0);
+        double t0 = now();
+        kernels[k].search(0, span, miss);
+        double t = now() - t0;
+        print_row("kernel", kernels[k].name, 1, "hashes_per_sec", span/t, "hash/s");
+    }
+
+    /* 1.1 Índice inverso: construcción desde cero, apertura y consultas */
+    if (index_path != NULL && puzzle == POW_SIMPLE) {
+        hash_index *idx = NULL;
+        long int lookups = 10000000, errors = 0;
+
+        unlink(index_path);
+        double t0 = now();
+        if (index_build(index_path, max_threads) == -1) {
+            fprintf(stderr, "Error construyendo el índice.\n");
+            exit(EXIT_FAILURE);
+        }
+        print_row("index", "build", max_threads, "seconds", now() - t0, "s");
+
+        t0 = now();
+        idx = index_open(index_path);
+        if (idx == NULL) {
+            fprintf(stderr, "Error abriendo el índice.\n");
+            exit(EXIT_FAILURE);
+        }
+        print_row("index", "open", 1, "seconds", now() - t0, "s");
+        print_row("index", "format", 1, "header_bytes", INDEX_HEADER_SIZE, "B");
+        print_row("index", "format", 1, "file_bytes", idx->size, "B");
+
+        /* Consultas a targets aleatorios, comprobando cada una */
+        t0 = now();
+        unsigned int seed = 1;
+        for (long int i = 0; i < lookups; i++) {
+            long int n = rand_r(&seed) % PRIME;
+            if (index_lookup(idx, simple_hash(n)) != n) errors++;
+        }
+        double t = now() - t0;
+        print_row("index", "lookup", 1, "lookups_per_sec", lookups/t, "lookup/s");
+        if (errors != 0) {
+            fprintf(stderr, "El índice tiene %ld entradas incorrectas.\n", errors);
+            index_close(idx);
+            exit(EXIT_FAILURE);
+        }
+        index_close(idx);
+    }
+
+    /* 2. Escalabilidad del pool de 1 a max_threads hilos */
+    worker_struct *jobs = (worker_struct *)aligned_alloc(CACHE_LINE, max_threads*sizeof(worker_struct));
+    if (jobs == NULL) {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int n = 1; n <= max_threads; n++) {
+        long int solution = -1;
+        worker_pool *pool = pool_ini(n, NULL);
+        if (pool == NULL) {
+            fprintf(stderr, "Error en pool_ini.\n");
+            free(jobs);
+            exit(EXIT_FAILURE);
+        }
+
+        double t = timed_round(pool, jobs, &sched, span, miss, &solution);
+        print_row("scaling", best, n, "hashes_per_sec", span/t, "hash/s");
+        print_row("scaling", best, n, "hashes_per_sec_per_thread", span/t/n, "hash/s");
+
+        /* 3. Con el máximo de hilos medimos el tiempo hasta la solución */
+        if (n == max_threads) {
+            pow_select(puzzle, difficulty);
+            double *times = (double *)malloc(samples*sizeof(double)), sum = 0;
+            if (times == NULL) {
+                perror("malloc");
+                pool_destroy(pool);
+                free(jobs);
+                exit(EXIT_FAILURE);
+            }
+
+            for (int i = 0; i < samples; i++) {
+                long int target = simple_hash(rand() % PRIME);
+                times[i] = timed_round(pool, jobs, &sched, pow_domain(), target, &solution);
+                if (solution == -1 || pow_verify(target, solution) == 0) {
+                    fprintf(stderr, "Solución incorrecta: %ld para el target %ld.\n", solution, target);
+                    free(times);
+                    pool_destroy(pool);
+                    free(jobs);
+                    exit(EXIT_FAILURE);
+                }
+                sum += times[i];
+            }
+
+            qsort(times, samples, sizeof(double), cmp_double);
+            print_row("time_to_solution", best, n, "min", times[0], "s");
+            print_row("time_to_solution", best, n, "p50", times[samples/2], "s");
+            print_row("time_to_solution", best, n, "p90", times[(samples*9)/10], "s");
+            print_row("time_to_solution", best, n, "p99", times[(samples*99)/100], "s");
+            print_row("time_to_solution", best, n, "max", times[samples-1], "s");
+            print_row("time_to_solution", best, n, "mean", sum/samples, "s");
+            free(times);
+        }
+
+        pool_destroy(pool);
+    }
+
+    if (json == 1) printf("\n]\n");
+
+    sched_free(&sched);
+    free(jobs);
+    return 0;
+}
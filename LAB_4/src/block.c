@@ -6,6 +6,13 @@
  * usadas para manejar bloques.
  * @version 0.1 - Implementación bloques.
  *          0.2 - Memoria compartida bloques.
+ *          0.3 - Pool de bloques sin malloc.
+ *          0.4 - Wallets copy-on-write.
+ *          0.5 - Almacén binario de la cadena.
+ *          0.6 - Cadena contigua con acceso por id.
+ *          0.7 - Poda de la cadena con instantánea.
+ *          0.8 - Acceso por posición al almacén.
+ *          0.9 - Wallets en dos niveles y registros con el ganador.
  * @date 2021-04-27
  * 
  * @copyright Copyright (c) 2021
@@ -13,49 +20,194 @@
  */
 #include "block.h"
 
+static slab_pool block_slabs = SLAB_POOL_INIT(Block);
+static slab_pool set_slabs = SLAB_POOL_INIT(wallet_set);
+static slab_pool dir_slabs = SLAB_POOL_INIT(wallet_dir);
+static slab_pool page_slabs = SLAB_POOL_INIT(wallet_page);
+
+wallet_set *wallets_ref(wallet_set *w) {
+    if (w != NULL) atomic_fetch_add_explicit(&w->refs, 1, memory_order_relaxed);
+    return w;
+}
+
+/**
+ * @brief Función que suelta una referencia a una página.
+ */
+static void page_unref(wallet_page *page) {
+    if (page == NULL) return;
+    if (atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1)
+        slab_free(&page_slabs, page);
+}
+
+/**
+ * @brief Función que suelta una referencia a un directorio.
+ */
+static void dir_unref(wallet_dir *dir) {
+    if (dir == NULL) return;
+    if (atomic_fetch_sub_explicit(&dir->refs, 1, memory_order_acq_rel) != 1) return;
+
+    for (int p = 0; p < WALLET_DIR; p++) page_unref(dir->pages[p]);
+    slab_free(&dir_slabs, dir);
+}
+
+void wallets_unref(wallet_set *w) {
+    if (w == NULL) return;
+    if (atomic_fetch_sub_explicit(&w->refs, 1, memory_order_acq_rel) != 1) return;
+
+    for (int d = 0; d < WALLET_DIRS; d++) dir_unref(w->dirs[d]);
+    slab_free(&set_slabs, w);
+}
+
+void wallets_assign(wallet_set **dest, wallet_set *src) {
+    wallet_set *old = NULL;
+
+    if (dest == NULL || *dest == src) return;
+
+    old = *dest;
+    *dest = wallets_ref(src);
+    wallets_unref(old);
+}
+
+int wallets_get(const wallet_set *w, int i) {
+    const wallet_dir *dir = NULL;
+    const wallet_page *page = NULL;
+
+    if (w == NULL || i < 0 || i >= WALLET_MAX) return 0;
+    if ((dir = w->dirs[i / (WALLET_PAGE*WALLET_DIR)]) == NULL) return 0;
+    if ((page = dir->pages[(i / WALLET_PAGE) % WALLET_DIR]) == NULL) return 0;
+    return page->values[i % WALLET_PAGE];
+}
+
+int wallets_set(wallet_set **w, int i, int value) {
+    wallet_set *set = NULL;
+    wallet_dir *dir = NULL;
+    wallet_page *page = NULL;
+    int d = i / (WALLET_PAGE*WALLET_DIR), p = (i / WALLET_PAGE) % WALLET_DIR;
+
+    if (w == NULL || i < 0 || i >= WALLET_MAX) return -1;
+    if (wallets_get(*w, i) == value) return 0;
+
+    /* Si las wallets son de otro bloque las copiamos, compartiendo directorios */
+    set = *w;
+    if (set == NULL || atomic_load_explicit(&set->refs, memory_order_acquire) > 1) {
+        set = (wallet_set *)slab_alloc(&set_slabs);
+        if (set == NULL) return -1;
+        atomic_init(&set->refs, 1);
+        for (int k = 0; k < WALLET_DIRS; k++) {
+            set->dirs[k] = *w != NULL ? (*w)->dirs[k] : NULL;
+            if (set->dirs[k] != NULL) atomic_fetch_add_explicit(&set->dirs[k]->refs, 1, memory_order_relaxed);
+        }
+        wallets_unref(*w);
+        *w = set;
+    }
+
+    /* Lo mismo con el directorio... */
+    dir = set->dirs[d];
+    if (dir == NULL || atomic_load_explicit(&dir->refs, memory_order_acquire) > 1) {
+        dir = (wallet_dir *)slab_alloc(&dir_slabs);
+        if (dir == NULL) return -1;
+        atomic_init(&dir->refs, 1);
+        for (int k = 0; k < WALLET_DIR; k++) {
+            dir->pages[k] = set->dirs[d] != NULL ? set->dirs[d]->pages[k] : NULL;
+            if (dir->pages[k] != NULL) atomic_fetch_add_explicit(&dir->pages[k]->refs, 1, memory_order_relaxed);
+        }
+        dir_unref(set->dirs[d]);
+        set->dirs[d] = dir;
+    }
+
+    /* ...y con la página que cambia */
+    page = dir->pages[p];
+    if (page == NULL || atomic_load_explicit(&page->refs, memory_order_acquire) > 1) {
+        page = (wallet_page *)slab_alloc(&page_slabs);
+        if (page == NULL) return -1;
+        atomic_init(&page->refs, 1);
+        for (int k = 0; k < WALLET_PAGE; k++)
+            page->values[k] = dir->pages[p] != NULL ? dir->pages[p]->values[k] : 0;
+        page_unref(dir->pages[p]);
+        dir->pages[p] = page;
+    }
+
+    page->values[i % WALLET_PAGE] = value;
+    return 0;
+}
+
+int wallets_next(const wallet_set *w, int i) {
+    if (w == NULL || i < 0) return -1;
+
+    while (i < WALLET_MAX) {
+        const wallet_dir *dir = w->dirs[i / (WALLET_PAGE*WALLET_DIR)];
+        const wallet_page *page = NULL;
+
+        /* Directorio o página vacíos: saltamos al principio del siguiente */
+        if (dir == NULL) {
+            i = (i / (WALLET_PAGE*WALLET_DIR) + 1)*WALLET_PAGE*WALLET_DIR;
+            continue;
+        }
+        page = dir->pages[(i / WALLET_PAGE) % WALLET_DIR];
+        if (page == NULL) {
+            i = (i / WALLET_PAGE + 1)*WALLET_PAGE;
+            continue;
+        }
+
+        if (page->values[i % WALLET_PAGE] != 0) return i;
+        i++;
+    }
+
+    return -1;
+}
+
+int block_pool_ini(int num_blocks) {
+    /* Cada bloque nuevo suele necesitar una raíz, un directorio y una página nuevos */
+    if (slab_reserve(&block_slabs, num_blocks) == -1
+        || slab_reserve(&set_slabs, num_blocks) == -1
+        || slab_reserve(&dir_slabs, num_blocks) == -1
+        || slab_reserve(&page_slabs, num_blocks) == -1) return -1;
+
+    return 0;
+}
+
+void block_pool_destroy() {
+    slab_destroy(&block_slabs);
+    slab_destroy(&set_slabs);
+    slab_destroy(&dir_slabs);
+    slab_destroy(&page_slabs);
+}
+
 Block *block_ini() {
     Block *block = NULL;
 
-    block = (Block *)malloc(sizeof(Block));
-    if (block == NULL) {
-        perror("malloc");
-        return NULL;
-    }
+    block = (Block *)slab_alloc(&block_slabs);
+    if (block == NULL) return NULL;
+
+    block->wallets = NULL;
+    block->next = NULL;
+    block->prev = NULL;
 
     return block;
 }
 
 int block_set(Block *prev, Block *block) {
-    Block *last_block = NULL;
-
     if (block == NULL)
         return -1;
 
     /* Inicializamos los datos necesarios */
-    if (last_block != NULL) block->id = last_block->id + 1;
+    if (prev != NULL) block->id = prev->id + 1;
     else block->id = 0;
     block->next = NULL;
-    block->prev = last_block;
+    block->prev = prev;
 
     /* Si somos el primer bloque no hay anterior */
-    if (last_block != NULL) block->target = last_block->solution;
+    if (prev != NULL) block->target = prev->solution;
     else block->target = -1;
 
     block->solution = -1;
     block->is_valid = -1;
+    block->winner = -1;
 
-    /* Inicializando las wallets */
-    if (last_block != NULL) {
-        /* Somos el último bloque copiamos las wallets */
-        for (int i = 0; i < MAX_MINERS; i++) 
-            block->wallets[i] = last_block->wallets[i];
-    } else {
-        /* Somos el primer bloque, nuevas wallets */
-        for (int i = 0; i < MAX_MINERS; i++) 
-            block->wallets[i] = 0;
-    }
+    /* Compartimos las wallets del anterior (o empezamos todas a cero) */
+    wallets_assign(&block->wallets, prev != NULL ? prev->wallets : NULL);
     
-    if (last_block != NULL) last_block->next = block;
+    if (prev != NULL) prev->next = block;
 
     return 0;
 }
@@ -69,7 +221,8 @@ int block_copy(Block *src, Block *dest) {
     dest->prev = src->prev;
     dest->solution = src->solution;
     dest->target = src->target;
-    for (int i = 0; i < MAX_MINERS; i++) dest->wallets[i] = src->wallets[i];
+    dest->winner = src->winner;
+    wallets_assign(&dest->wallets, src->wallets);
 
     return 0;
 }
@@ -78,8 +231,9 @@ void block_destroy(Block *block) {
     if (block == NULL)
         return;
 
-    free(block);
-    block = NULL;    
+    wallets_unref(block->wallets);
+    block->wallets = NULL;
+    slab_free(&block_slabs, block);
 }
 
 void block_destroy_blockchain(Block *block) {
@@ -100,6 +254,212 @@ void block_destroy_blockchain(Block *block) {
     } while (aux != NULL);
 }
 
+int block_to_record(const Block *block, block_record *rec) {
+    if (block == NULL || rec == NULL) return -1;
+
+    rec->id = block->id;
+    rec->is_valid = block->is_valid;
+    rec->target = block->target;
+    rec->solution = block->solution;
+    rec->winner = block->winner;
+    rec->balance = wallets_get(block->wallets, block->winner);
+
+    return 0;
+}
+
+int block_from_record(const block_record *rec, const Block *prev, Block *block) {
+    if (rec == NULL || block == NULL) return -1;
+
+    block->id = rec->id;
+    block->is_valid = rec->is_valid;
+    block->target = rec->target;
+    block->solution = rec->solution;
+    block->winner = rec->winner;
+    if (prev != NULL) wallets_assign(&block->wallets, prev->wallets);
+
+    if (rec->winner < 0) return 0;
+    return wallets_set(&block->wallets, rec->winner, rec->balance);
+}
+
+Chain *chain_ini() {
+    Chain *chain = (Chain *)calloc(1, sizeof(Chain));
+    if (chain == NULL) perror("calloc");
+    return chain;
+}
+
+Block *chain_append(Chain *chain) {
+    long int c = 0;
+    Block *block = NULL;
+
+    if (chain == NULL) return NULL;
+
+    /* Si la tabla de trozos está llena la doblamos */
+    c = (chain->length - chain->first) / CHAIN_CHUNK;
+    if (c >= chain->num_chunks) {
+        long int n = chain->num_chunks > 0 ? 2*chain->num_chunks : 16;
+        Block **chunks = (Block **)realloc(chain->chunks, n*sizeof(Block *));
+        if (chunks == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        for (long int k = chain->num_chunks; k < n; k++) chunks[k] = NULL;
+        chain->chunks = chunks;
+        chain->num_chunks = n;
+    }
+
+    if (chain->chunks[c] == NULL) {
+        Block *chunk = mmap(NULL, CHAIN_CHUNK*sizeof(Block), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) {
+            perror("mmap");
+            return NULL;
+        }
+        chain->chunks[c] = chunk;
+    }
+
+    block = &chain->chunks[c][(chain->length - chain->first) % CHAIN_CHUNK];
+    block->wallets = NULL;
+    if (block_set(chain_last(chain), block) == -1) return NULL;
+
+    /* Si todo lo anterior está podado seguimos desde la instantánea */
+    if (block->prev == NULL && chain->snapshot.height > 0) {
+        block->id = chain->snapshot.id + 1;
+        block->target = chain->snapshot.solution;
+        wallets_assign(&block->wallets, chain->snapshot.wallets);
+    }
+    chain->length += 1;
+
+    return block;
+}
+
+int chain_pop(Chain *chain) {
+    Block *block = chain_last(chain);
+
+    if (block == NULL) return -1;
+
+    if (block->prev != NULL) block->prev->next = NULL;
+    wallets_unref(block->wallets);
+    block->wallets = NULL;
+    chain->length -= 1;
+
+    return 0;
+}
+
+Block *chain_at(const Chain *chain, long int pos) {
+    if (chain == NULL || pos < chain->first || pos >= chain->length) return NULL;
+    pos -= chain->first;
+    return &chain->chunks[pos / CHAIN_CHUNK][pos % CHAIN_CHUNK];
+}
+
+Block *chain_last(const Chain *chain) {
+    if (chain == NULL) return NULL;
+    return chain_at(chain, chain->length - 1);
+}
+
+Block *chain_get(const Chain *chain, int id) {
+    long int lo = 0, hi = 0, pos = 0;
+    Block *block = NULL;
+
+    if (chain == NULL || chain->length == chain->first) return NULL;
+
+    /* Caso normal: ids consecutivos desde el primero */
+    pos = chain->first + ((long int)id - chain_at(chain, chain->first)->id);
+    block = chain_at(chain, pos);
+    if (block != NULL && block->id == id) return block;
+
+    lo = chain->first;
+    hi = chain->length - 1;
+    while (lo <= hi) {
+        pos = lo + (hi - lo)/2;
+        block = chain_at(chain, pos);
+        if (block->id == id) return block;
+        if (block->id < id) lo = pos + 1;
+        else hi = pos - 1;
+    }
+
+    return NULL;
+}
+
+long int chain_length(const Chain *chain) {
+    if (chain == NULL) return 0;
+    return chain->length;
+}
+
+long int chain_first(const Chain *chain) {
+    if (chain == NULL) return 0;
+    return chain->first;
+}
+
+/**
+ * @brief Función que invierte los trozos [lo, hi) de la tabla.
+ */
+static void chunks_reverse(Block **chunks, long int lo, long int hi) {
+    while (lo < --hi) {
+        Block *aux = chunks[lo];
+        chunks[lo++] = chunks[hi];
+        chunks[hi] = aux;
+    }
+}
+
+long int chain_prune(Chain *chain, long int horizon, block_store *store) {
+    long int drop = 0, pruned = 0, used = 0;
+    Block *block = NULL;
+
+    if (chain == NULL || horizon < 1) return -1;
+
+    /* Solo trozos enteros que queden fuera del horizonte */
+    drop = (chain->length - horizon - chain->first) / CHAIN_CHUNK;
+    if (drop <= 0) return 0;
+    pruned = drop*CHAIN_CHUNK;
+
+    /* Primero los escribimos todos, si falla no se poda nada. Los
+    que no se han validado (votación rechazada o sin votar) no van */
+    if (store != NULL) {
+        for (long int pos = chain->first; pos < chain->first + pruned; pos++) {
+            block_record rec;
+            if (chain_at(chain, pos)->is_valid != 1) continue;
+            block_to_record(chain_at(chain, pos), &rec);
+            if (block_store_append(store, &rec) == -1) return -1;
+        }
+    }
+
+    /* La instantánea es el último bloque podado */
+    block = chain_at(chain, chain->first + pruned - 1);
+    chain->snapshot.height = chain->first + pruned;
+    chain->snapshot.id = block->id;
+    chain->snapshot.target = block->target;
+    chain->snapshot.solution = block->solution;
+    wallets_assign(&chain->snapshot.wallets, block->wallets);
+
+    for (long int pos = chain->first; pos < chain->first + pruned; pos++)
+        wallets_unref(chain_at(chain, pos)->wallets);
+
+    /* Rotamos la tabla para que los trozos podados queden al final
+    como libres, así la memoria no crece */
+    used = (chain->length - chain->first + CHAIN_CHUNK - 1) / CHAIN_CHUNK;
+    chunks_reverse(chain->chunks, 0, drop);
+    chunks_reverse(chain->chunks, drop, used);
+    chunks_reverse(chain->chunks, 0, used);
+
+    chain->first += pruned;
+    chain_at(chain, chain->first)->prev = NULL;
+
+    return pruned;
+}
+
+void chain_destroy(Chain *chain) {
+    if (chain == NULL) return;
+
+    for (long int pos = chain->first; pos < chain->length; pos++)
+        wallets_unref(chain_at(chain, pos)->wallets);
+    wallets_unref(chain->snapshot.wallets);
+
+    for (long int c = 0; c < chain->num_chunks; c++)
+        if (chain->chunks[c] != NULL) munmap(chain->chunks[c], CHAIN_CHUNK*sizeof(Block));
+
+    free(chain->chunks);
+    free(chain);
+}
+
 shared_block_info *create_shared_block_info() {
     shared_block_info *sbi = NULL;
     int fd_shm;
@@ -128,7 +488,8 @@ shared_block_info *create_shared_block_info() {
         return NULL;
     }
 
-    for (int i = 0; i < MAX_MINERS; i++) sbi->wallets[i] = 0;
+    sbi->winner = -1;
+    sbi->balance = 0;
     sbi->num_miners = 1;
     sbi->solution = -1;
     sbi->is_valid = -1;
@@ -185,11 +546,20 @@ short update_block(shared_block_info *sbi, Block *block) {
     block->is_valid = sbi->is_valid;
     block->solution = sbi->solution;
     block->target = sbi->target;
-    for (int i = 0; i < MAX_MINERS; i++) block->wallets[i] = sbi->wallets[i];
+    block->winner = sbi->winner;
+    if (sbi->winner >= 0 && wallets_set(&block->wallets, sbi->winner, sbi->balance) == -1) return -1;
 
     return 0;
 }
 
+/**
+ * @brief Función que imprime las wallets con saldo.
+ */
+static void print_wallets(FILE *pf, const wallet_set *w) {
+    for (int i = wallets_next(w, 0); i != -1; i = wallets_next(w, i + 1))
+        fprintf(pf," %d: %d |", i, wallets_get(w, i));
+}
+
 void print_blocks_in_file(FILE *pf, Block * block) {
     Block *aux = NULL;
 
@@ -203,12 +573,29 @@ void print_blocks_in_file(FILE *pf, Block * block) {
     /* Imprimimos toda la cadena */
     while(aux != NULL) {
         fprintf(pf, "BLOCK %d:\n\tis_valid: %d\n\ttarget: %ld\n\tsolution: %ld\nWallets:\n", aux->id, aux->is_valid, aux->target, aux->solution);
-        for (int i = 0; i < MAX_MINERS; i++) if (aux->wallets[i] != 0) fprintf(pf," %d: %d |", i, aux->wallets[i]);
+        print_wallets(pf, aux->wallets);
         fprintf(pf, "\n------------------------------------------------------------------------------\n");
         aux = aux->next;
     }
 }
 
+void print_chain_in_file(FILE *pf, const Chain *chain) {
+    if (pf == NULL || chain == NULL) return;
+
+    if (chain->snapshot.height > 0) {
+        fprintf(pf, "SNAPSHOT (%ld bloques podados) hasta el BLOCK %d:\n\ttarget: %ld\n\tsolution: %ld\nWallets:\n", chain->snapshot.height, chain->snapshot.id, chain->snapshot.target, chain->snapshot.solution);
+        print_wallets(pf, chain->snapshot.wallets);
+        fprintf(pf, "\n------------------------------------------------------------------------------\n");
+    }
+
+    for (long int pos = chain->first; pos < chain->length; pos++) {
+        const Block *aux = chain_at(chain, pos);
+        fprintf(pf, "BLOCK %d:\n\tis_valid: %d\n\ttarget: %ld\n\tsolution: %ld\nWallets:\n", aux->id, aux->is_valid, aux->target, aux->solution);
+        print_wallets(pf, aux->wallets);
+        fprintf(pf, "\n------------------------------------------------------------------------------\n");
+    }
+}
+
 void print_blocks(Block *plast_block, int num_wallets) {
     Block *block = NULL;
     int i, j;
@@ -216,9 +603,362 @@ void print_blocks(Block *plast_block, int num_wallets) {
     for(i = 0, block = plast_block; block != NULL; block = block->prev, i++) {
         printf("Block number: %d; Target: %ld;    Solution: %ld\n", block->id, block->target, block->solution);
         for(j = 0; j < num_wallets; j++) {
-            printf("%d: %d;         ", j, block->wallets[j]);
+            printf("%d: %d;         ", j, wallets_get(block->wallets, j));
         }
         printf("\n\n\n");
     }
     printf("A total of %d blocks were printed\n", i);
 }
+
+/**
+ * @brief Función que calcula el CRC-32 (polinomio 0xEDB88320) de un buffer.
+ *
+ * @param data Datos.
+ * @param len Longitud en bytes.
+ * @return uint32_t CRC.
+ */
+static uint32_t crc32(const void *data, size_t len) {
+    static uint32_t table[8][256];
+    static atomic_int table_ready = 0;
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t crc = 0xFFFFFFFF, one = 0, two = 0;
+
+    /* Si dos hilos la construyen a la vez escriben lo mismo */
+    if (atomic_load_explicit(&table_ready, memory_order_acquire) == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[0][i] = c;
+        }
+        for (int t = 1; t < 8; t++)
+            for (int i = 0; i < 256; i++) table[t][i] = (table[t-1][i] >> 8) ^ table[0][table[t-1][i] & 0xFF];
+        atomic_store_explicit(&table_ready, 1, memory_order_release);
+    }
+
+    /* Slicing-by-8: 8 bytes por iteración en vez de uno. Las entradas
+    ya se guardan en el orden de bytes de la máquina (little endian) */
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&one, p, 4);
+        memcpy(&two, p + 4, 4);
+        one ^= crc;
+        crc = table[7][one & 0xFF] ^ table[6][(one >> 8) & 0xFF] ^ table[5][(one >> 16) & 0xFF] ^ table[4][one >> 24]
+            ^ table[3][two & 0xFF] ^ table[2][(two >> 8) & 0xFF] ^ table[1][(two >> 16) & 0xFF] ^ table[0][two >> 24];
+    }
+    for (; len > 0; len--, p++) crc = table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * @brief Función que comprueba que una entrada está completa y su CRC es correcto.
+ */
+static int entry_valid(const store_entry *entry) {
+    return entry->size == sizeof(block_record) && entry->checksum == crc32(&entry->rec, sizeof(block_record));
+}
+
+/**
+ * @brief Función que vuelve a mapear los ficheros si han crecido
+ * desde el último mapa (porque se ha añadido algo).
+ *
+ * @param st Almacén.
+ * @return int 0 OK, -1 ERR.
+ */
+static int store_remap(block_store *st) {
+    struct stat seg, idx;
+
+    if (fstat(st->fd, &seg) == -1 || fstat(st->idx_fd, &idx) == -1) {
+        perror("fstat");
+        return -1;
+    }
+
+    /* Un lector solo ve las entradas completas */
+    if (st->mode == STORE_READ)
+        st->size = STORE_HEADER_SIZE + (seg.st_size - STORE_HEADER_SIZE)/sizeof(store_entry)*sizeof(store_entry);
+
+    if ((size_t)seg.st_size != st->map_size) {
+        if (st->map != NULL) munmap((void *)st->map, st->map_size);
+        st->map = mmap(NULL, seg.st_size, PROT_READ, MAP_SHARED, st->fd, 0);
+        if (st->map == MAP_FAILED) {
+            perror("mmap");
+            st->map = NULL;
+            st->map_size = 0;
+            return -1;
+        }
+        st->map_size = seg.st_size;
+    }
+
+    if ((size_t)idx.st_size != st->idx_map_size) {
+        if (st->offsets != NULL) munmap((void *)st->offsets, st->idx_map_size);
+        st->offsets = mmap(NULL, idx.st_size, PROT_READ, MAP_SHARED, st->idx_fd, 0);
+        if (st->offsets == MAP_FAILED) {
+            perror("mmap");
+            st->offsets = NULL;
+            st->idx_map_size = 0;
+            return -1;
+        }
+        st->idx_map_size = idx.st_size;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Función que escribe en el índice el offset de un id.
+ */
+static int index_put(block_store *st, int id, uint64_t offset) {
+    if (id < 0) return -1;
+    if (pwrite(st->idx_fd, &offset, sizeof(uint64_t), STORE_HEADER_SIZE + (off_t)id*sizeof(uint64_t)) != sizeof(uint64_t)) {
+        perror("pwrite");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Función que guarda en la cabecera del índice hasta dónde
+ * está indexado el segmento.
+ */
+static int index_cover(block_store *st) {
+    uint64_t covered = st->size;
+
+    if (pwrite(st->idx_fd, &covered, sizeof(uint64_t), offsetof(store_index_header, covered)) != sizeof(uint64_t)) {
+        perror("pwrite");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Función que indexa las entradas que el índice no cubre y
+ * corta la primera entrada incompleta o corrupta (y lo que la siga).
+ *
+ * @param st Almacén abierto para escribir.
+ * @param covered Offset hasta el que el índice está al día.
+ * @return int 0 OK, -1 ERR.
+ */
+static int store_recover(block_store *st, uint64_t covered) {
+    struct stat seg;
+    store_entry entry;
+    uint64_t off = covered;
+
+    if (fstat(st->fd, &seg) == -1) {
+        perror("fstat");
+        return -1;
+    }
+
+    /* Si el índice no cuadra con el segmento lo rehacemos entero */
+    if (off < STORE_HEADER_SIZE || off > (uint64_t)seg.st_size || (off - STORE_HEADER_SIZE) % sizeof(store_entry) != 0)
+        off = STORE_HEADER_SIZE;
+
+    while (off + sizeof(store_entry) <= (uint64_t)seg.st_size) {
+        if (pread(st->fd, &entry, sizeof(store_entry), off) != sizeof(store_entry) || !entry_valid(&entry)) break;
+        if (index_put(st, entry.rec.id, off) == -1) return -1;
+        off += sizeof(store_entry);
+    }
+
+    if (off != (uint64_t)seg.st_size && ftruncate(st->fd, off) == -1) {
+        perror("ftruncate");
+        return -1;
+    }
+
+    st->size = off;
+    return index_cover(st);
+}
+
+block_store *block_store_open(const char *path, int mode) {
+    char idx_path[4096];
+    block_store *st = NULL;
+    store_header header, expected;
+    store_index_header idx_header, idx_expected;
+    int flags = O_RDONLY;
+    struct stat seg;
+
+    if (path == NULL || mode < STORE_READ || mode > STORE_CREATE) return NULL;
+
+    memset(&expected, 0, sizeof(expected));
+    memcpy(expected.magic, STORE_MAGIC, sizeof(expected.magic));
+    expected.version = STORE_VERSION;
+    expected.entry_size = sizeof(store_entry);
+    expected.max_wallets = WALLET_MAX;
+
+    memset(&idx_expected, 0, sizeof(idx_expected));
+    memcpy(idx_expected.magic, STORE_INDEX_MAGIC, sizeof(idx_expected.magic));
+    idx_expected.version = STORE_VERSION;
+    idx_expected.covered = STORE_HEADER_SIZE;
+
+    if (mode == STORE_APPEND) flags = O_RDWR | O_CREAT;
+    else if (mode == STORE_CREATE) flags = O_RDWR | O_CREAT | O_TRUNC;
+
+    st = (block_store *)calloc(1, sizeof(block_store));
+    if (st == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    st->mode = mode;
+    st->idx_fd = -1;
+
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    st->fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (st->fd != -1) st->idx_fd = open(idx_path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (st->fd == -1 || st->idx_fd == -1 || fstat(st->fd, &seg) == -1) {
+        perror("open");
+        block_store_close(st);
+        return NULL;
+    }
+
+    /* Segmento: si es nuevo escribimos la cabecera, si no la comprobamos */
+    if (seg.st_size == 0 && mode != STORE_READ) {
+        char zeros[STORE_HEADER_SIZE] = {0};
+        memcpy(zeros, &expected, sizeof(expected));
+        if (pwrite(st->fd, zeros, STORE_HEADER_SIZE, 0) != STORE_HEADER_SIZE) {
+            perror("pwrite");
+            block_store_close(st);
+            return NULL;
+        }
+    } else if (pread(st->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(&header, &expected, sizeof(header)) != 0) {
+        fprintf(stderr, "%s no es un almacén de bloques compatible.\n", path);
+        block_store_close(st);
+        return NULL;
+    }
+
+    /* Índice: si no es válido lo rehacemos desde el principio del segmento */
+    if (pread(st->idx_fd, &idx_header, sizeof(idx_header), 0) != sizeof(idx_header)
+        || memcmp(idx_header.magic, idx_expected.magic, sizeof(idx_header.magic)) != 0
+        || idx_header.version != STORE_VERSION) {
+        char zeros[STORE_HEADER_SIZE] = {0};
+
+        if (mode == STORE_READ) {
+            fprintf(stderr, "El índice %s no es válido.\n", idx_path);
+            block_store_close(st);
+            return NULL;
+        }
+
+        memcpy(zeros, &idx_expected, sizeof(idx_expected));
+        if (ftruncate(st->idx_fd, 0) == -1 || pwrite(st->idx_fd, zeros, STORE_HEADER_SIZE, 0) != STORE_HEADER_SIZE) {
+            perror("pwrite");
+            block_store_close(st);
+            return NULL;
+        }
+        idx_header = idx_expected;
+    }
+
+    if (mode != STORE_READ && store_recover(st, idx_header.covered) == -1) {
+        block_store_close(st);
+        return NULL;
+    }
+
+    if (store_remap(st) == -1) {
+        block_store_close(st);
+        return NULL;
+    }
+
+    return st;
+}
+
+int block_store_append(block_store *st, const block_record *rec) {
+    store_entry entry;
+
+    if (st == NULL || rec == NULL || st->mode == STORE_READ || rec->id < 0) return -1;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.rec = *rec;
+    entry.size = sizeof(block_record);
+    entry.checksum = crc32(&entry.rec, sizeof(block_record));
+
+    /* Primero el bloque y después el índice, así tras un corte el
+    índice nunca apunta a una entrada que no existe */
+    if (pwrite(st->fd, &entry, sizeof(entry), st->size) != sizeof(entry)) {
+        perror("pwrite");
+        return -1;
+    }
+    if (index_put(st, rec->id, st->size) == -1) return -1;
+    st->size += sizeof(entry);
+
+    return index_cover(st);
+}
+
+int block_store_follow(block_store *st, int id) {
+    const block_record *last = NULL;
+    long int count = 0;
+
+    if (st == NULL || st->mode == STORE_READ) return -1;
+
+    count = block_store_count(st);
+    if (count == 0) return 0;
+    if (store_remap(st) == -1) return -1;
+
+    last = block_store_at(st, count - 1);
+    if (last != NULL && last->id < id) return 0;
+
+    /* La cadena guardada es de otra red, empezamos de nuevo */
+    st->size = STORE_HEADER_SIZE;
+    if (ftruncate(st->fd, STORE_HEADER_SIZE) == -1 || ftruncate(st->idx_fd, STORE_HEADER_SIZE) == -1) {
+        perror("ftruncate");
+        return -1;
+    }
+    if (index_cover(st) == -1) return -1;
+
+    return store_remap(st);
+}
+
+const block_record *block_store_lookup(block_store *st, int id) {
+    const store_entry *entry = NULL;
+    uint64_t off = 0;
+
+    if (st == NULL || id < 0 || store_remap(st) == -1) return NULL;
+    if (st->offsets == NULL || STORE_HEADER_SIZE + ((size_t)id + 1)*sizeof(uint64_t) > st->idx_map_size) return NULL;
+
+    off = st->offsets[STORE_HEADER_SIZE/sizeof(uint64_t) + id];
+    if (off < STORE_HEADER_SIZE || off + sizeof(store_entry) > st->size) return NULL;
+
+    entry = (const store_entry *)(st->map + off);
+    if (!entry_valid(entry) || entry->rec.id != id) return NULL;
+
+    return &entry->rec;
+}
+
+const block_record *block_store_at(const block_store *st, long int pos) {
+    const store_entry *entry = NULL;
+    uint64_t off = 0;
+
+    if (st == NULL || pos < 0) return NULL;
+
+    off = STORE_HEADER_SIZE + (uint64_t)pos*sizeof(store_entry);
+    if (off + sizeof(store_entry) > st->size || off + sizeof(store_entry) > st->map_size) return NULL;
+
+    entry = (const store_entry *)(st->map + off);
+    if (!entry_valid(entry)) return NULL;
+
+    return &entry->rec;
+}
+
+long int block_store_iterate(block_store *st, int (*fn)(const block_record *rec, void *arg), void *arg) {
+    long int n = 0;
+
+    if (st == NULL || store_remap(st) == -1) return -1;
+
+    for (uint64_t off = STORE_HEADER_SIZE; off + sizeof(store_entry) <= st->size; off += sizeof(store_entry)) {
+        const store_entry *entry = (const store_entry *)(st->map + off);
+        if (!entry_valid(entry)) return -1;
+        n++;
+        if (fn != NULL && fn(&entry->rec, arg) != 0) break;
+    }
+
+    return n;
+}
+
+long int block_store_count(block_store *st) {
+    if (st == NULL) return 0;
+    if (st->mode == STORE_READ) store_remap(st);
+    return (st->size - STORE_HEADER_SIZE)/sizeof(store_entry);
+}
+
+void block_store_close(block_store *st) {
+    if (st == NULL) return;
+
+    if (st->map != NULL) munmap((void *)st->map, st->map_size);
+    if (st->offsets != NULL) munmap((void *)st->offsets, st->idx_map_size);
+    if (st->fd != -1) close(st->fd);
+    if (st->idx_fd != -1) close(st->idx_fd);
+    free(st);
+}
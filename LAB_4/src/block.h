@@ -6,6 +6,13 @@
  * de las funciones usadas para manejar bloques.
  * @version 0.1 - Implementación de bloques.
  *          0.2 - Memoria compartida bloques.
+ *          0.3 - Pool de bloques sin malloc.
+ *          0.4 - Wallets copy-on-write.
+ *          0.5 - Almacén binario de la cadena.
+ *          0.6 - Cadena contigua con acceso por id.
+ *          0.7 - Poda de la cadena con instantánea.
+ *          0.8 - Acceso por posición al almacén.
+ *          0.9 - Wallets en dos niveles y registros con el ganador.
  * @date 2021-04-27
  * 
  * @copyright Copyright (c) 2021
@@ -22,32 +29,421 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
 
-#define MAX_MINERS 200
+#include "slab.h"
+
+/* Los bloques, y las raíces y páginas de sus wallets, salen de pools
+de slab.h. block_ini, block_destroy y las funciones de wallets se pueden
+llamar desde un manejador de señal y nunca usan malloc.
+BLOCK_SLAB_SIZE es lo que se reserva de antemano con block_pool_ini. */
+#define BLOCK_SLAB_SIZE SLAB_OBJECTS
+
+/* Las wallets se guardan en páginas de WALLET_PAGE enteros compartidas
+entre bloques (copy-on-write). Las páginas cuelgan de directorios de
+WALLET_DIR páginas y los directorios de la raíz, así que un bloque solo
+copia la raíz, un directorio y la página que cambia: una cadena larga
+ocupa O(cambios), copiar un bloque es O(1) y ninguna de las dos cosas
+crece con el número de mineros. */
+#define WALLET_PAGE 64
+#define WALLET_DIR 32
+#define WALLET_DIRS 32
+#define WALLET_MAX (WALLET_PAGE*WALLET_DIR*WALLET_DIRS)
 
 #define SHM_NAME_BLOCK "/block"
 
+typedef struct {
+    atomic_int refs;
+    int values[WALLET_PAGE];
+} wallet_page;
+
+typedef struct {
+    atomic_int refs;
+    wallet_page *pages[WALLET_DIR];
+} wallet_dir;
+
+/* Una página o un directorio NULL son todo ceros, así que un
+wallet_set NULL representa todas las wallets a cero */
+typedef struct {
+    atomic_int refs;
+    wallet_dir *dirs[WALLET_DIRS];
+} wallet_set;
+
 typedef struct _Block {
-    int wallets[MAX_MINERS];
+    wallet_set *wallets;
     long int target;
     long int solution;
     int id;
     int is_valid;
+    int winner; /* Wallet que cobra el bloque, -1 si ninguna */
     struct _Block *next;
     struct _Block *prev;
 } Block;
 
+/* Último bloque de la red. Los saldos están en el ledger (ledger.h),
+aquí solo va quién ha cobrado el bloque y con qué saldo se queda */
 typedef struct {
     long int target;
     long int solution;
     int id;
     int is_valid;
     int num_miners;
-    int wallets[MAX_MINERS];
+    int winner;
+    int balance;
 } shared_block_info;
 
+/* Bloque plano que se envía a otro proceso, donde los punteros de
+Block no valen nada. En lugar de todas las wallets lleva el ganador y
+su saldo nuevo, así que no crece con el número de mineros: las
+wallets de un bloque son las del anterior con la del ganador a balance. */
+typedef struct {
+    long int target;
+    long int solution;
+    int id;
+    int is_valid;
+    int winner;
+    int balance;
+} block_record;
+
+/* Cadena de bloques contigua. Los bloques viven en trozos de
+CHAIN_CHUNK bloques reservados con mmap que no se mueven nunca, así que
+los punteros a un bloque de la cadena son estables. La tabla de trozos
+crece al doble cuando se llena. prev y next se siguen manteniendo para
+que funcionen las funciones de bloque de siempre.
+Las posiciones son absolutas desde el primer bloque minado. Al podar se
+quitan trozos enteros del principio: first pasa a ser la posición del
+primer bloque en memoria, los trozos libres se guardan al final de la
+tabla para reutilizarlos y snapshot resume el estado hasta first. */
+#define CHAIN_CHUNK 1024
+
+/* Bloques que se dejan en memoria por defecto al podar */
+#define CHAIN_HORIZON (4*CHAIN_CHUNK)
+
+/* Estado de la cadena en el último bloque podado */
+typedef struct {
+    long int height; /* Bloques podados, 0 si no se ha podado nada */
+    int id;
+    long int target;
+    long int solution;
+    wallet_set *wallets;
+} chain_snapshot;
+
+typedef struct {
+    Block **chunks;
+    long int num_chunks;
+    long int first;
+    long int length;
+    chain_snapshot snapshot;
+} Chain;
+
+/**
+ * @brief Función que crea una cadena vacía.
+ * 
+ * @return Chain* Cadena, NULL si ERR.
+ */
+Chain *chain_ini();
+
+/**
+ * @brief Función que añade un bloque al final de la cadena y lo
+ * inicializa como block_set con el último bloque.
+ * 
+ * @param chain Cadena.
+ * @return Block* Bloque añadido, NULL si ERR.
+ */
+Block *chain_append(Chain *chain);
+
+/**
+ * @brief Función que quita el último bloque de la cadena.
+ * 
+ * @param chain Cadena.
+ * @return int 0 OK, -1 ERR (cadena vacía).
+ */
+int chain_pop(Chain *chain);
+
+/**
+ * @brief Función que devuelve el bloque en una posición, en O(1).
+ * 
+ * @param chain Cadena.
+ * @param pos Posición, 0 es el primer bloque minado.
+ * @return Block* Bloque, NULL si pos está fuera de la cadena o ya
+ * se ha podado.
+ */
+Block *chain_at(const Chain *chain, long int pos);
+
+/**
+ * @brief Función que devuelve el último bloque.
+ * 
+ * @param chain Cadena.
+ * @return Block* Bloque, NULL si la cadena está vacía.
+ */
+Block *chain_last(const Chain *chain);
+
+/**
+ * @brief Función que busca un bloque por id. Los ids de la cadena
+ * crecen, y si son consecutivos la búsqueda es O(1); si hay huecos
+ * es una búsqueda binaria.
+ * 
+ * @param chain Cadena.
+ * @param id Id buscado.
+ * @return Block* Bloque, NULL si no está.
+ */
+Block *chain_get(const Chain *chain, int id);
+
+/**
+ * @brief Función que devuelve el número de bloques de la cadena,
+ * contando los podados.
+ * 
+ * @param chain Cadena.
+ * @return long int Número de bloques.
+ */
+long int chain_length(const Chain *chain);
+
+/**
+ * @brief Función que devuelve la posición del primer bloque que
+ * sigue en memoria.
+ * 
+ * @param chain Cadena.
+ * @return long int Posición.
+ */
+long int chain_first(const Chain *chain);
+
+/**
+ * @brief Función que destruye la cadena y todos sus bloques.
+ * 
+ * @param chain Cadena.
+ */
+void chain_destroy(Chain *chain);
+
+/**
+ * @brief Función para imprimir una cadena en un archivo, en orden.
+ * 
+ * @param pf Archivo donde imprimir.
+ * @param chain Cadena.
+ */
+void print_chain_in_file(FILE *pf, const Chain *chain);
+
+/* Almacén binario de la cadena, solo de añadir. Son dos ficheros:
+ *      path      store_header (STORE_HEADER_SIZE bytes) y después una
+ *                store_entry de tamaño fijo por bloque, en orden de llegada.
+ *      path.idx  store_index_header (STORE_HEADER_SIZE bytes) y después
+ *                uint64_t offsets[id], el offset en path de la última
+ *                entrada con ese id (0 si no hay ninguna).
+ * Todo en el orden de bytes de la máquina. Cada entrada lleva el CRC-32
+ * de su block_record. El índice guarda hasta qué offset del segmento
+ * está indexado; al abrir para escribir se indexa lo que falte y se
+ * corta una última entrada incompleta o con el CRC mal. Los lectores
+ * mapean los dos ficheros y devuelven punteros dentro del mapa. */
+#define STORE_MAGIC "BLKSTORE"
+#define STORE_INDEX_MAGIC "BLKINDEX"
+#define STORE_VERSION 2
+#define STORE_HEADER_SIZE 64
+
+#define STORE_READ 0
+#define STORE_APPEND 1
+#define STORE_CREATE 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t max_wallets;
+} store_header;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t covered;
+} store_index_header;
+
+typedef struct {
+    uint32_t checksum;
+    uint32_t size;
+    block_record rec;
+} store_entry;
+
+typedef struct {
+    int fd;
+    int idx_fd;
+    int mode;
+    const char *map;
+    size_t map_size;
+    const uint64_t *offsets;
+    size_t idx_map_size;
+    uint64_t size;
+} block_store;
+
+/**
+ * @brief Función que abre un almacén.
+ * 
+ * @param path Fichero del segmento (el índice es path.idx).
+ * @param mode STORE_READ, STORE_APPEND o STORE_CREATE (lo vacía).
+ * @return block_store* Almacén, NULL si ERR.
+ */
+block_store *block_store_open(const char *path, int mode);
+
 /**
- * @brief Función para reserver memoria de un bloque.
+ * @brief Función que añade un bloque al final del almacén.
+ * 
+ * @param st Almacén abierto con STORE_APPEND o STORE_CREATE.
+ * @param rec Bloque plano.
+ * @return int 0 OK, -1 ERR.
+ */
+int block_store_append(block_store *st, const block_record *rec);
+
+/**
+ * @brief Función que prepara un almacén abierto con STORE_APPEND para
+ * seguir con el bloque id. Si su última entrada ya tiene ese id o uno
+ * mayor es de una red anterior (una red nueva vuelve a empezar por el
+ * id 0 con las wallets vacías) y se vacía. Si no, se sigue añadiendo
+ * detrás de lo que ya hay.
+ * 
+ * @param st Almacén.
+ * @param id Id del primer bloque que se va a añadir.
+ * @return int 0 OK, -1 ERR.
+ */
+int block_store_follow(block_store *st, int id);
+
+/**
+ * @brief Función que busca un bloque por id en O(1). No copia nada:
+ * el puntero apunta al mapa y vale hasta la siguiente llamada al
+ * almacén o hasta cerrarlo.
+ * 
+ * @param st Almacén.
+ * @param id Id del bloque.
+ * @return const block_record* Bloque, NULL si no está o está corrupto.
+ */
+const block_record *block_store_lookup(block_store *st, int id);
+
+/**
+ * @brief Función que devuelve la entrada en la posición pos, en O(1)
+ * y sin copiar. No vuelve a mapear el fichero, así que varios hilos
+ * pueden llamarla a la vez con posiciones menores que las que dio
+ * block_store_count.
+ * 
+ * @param st Almacén.
+ * @param pos Posición, 0 es la primera entrada.
+ * @return const block_record* Bloque, NULL si no está o está corrupto.
+ */
+const block_record *block_store_at(const block_store *st, long int pos);
+
+/**
+ * @brief Función que recorre todas las entradas en orden de llegada.
+ * 
+ * @param st Almacén.
+ * @param fn Función a llamar con cada bloque, si devuelve distinto
+ * de 0 el recorrido para.
+ * @param arg Argumento para fn.
+ * @return long int Entradas recorridas, -1 si alguna está corrupta.
+ */
+long int block_store_iterate(block_store *st, int (*fn)(const block_record *rec, void *arg), void *arg);
+
+/**
+ * @brief Función que devuelve el número de entradas del almacén.
+ * 
+ * @param st Almacén.
+ * @return long int Número de entradas.
+ */
+long int block_store_count(block_store *st);
+
+/**
+ * @brief Función que cierra el almacén.
+ * 
+ * @param st Almacén.
+ */
+void block_store_close(block_store *st);
+
+/**
+ * @brief Función que poda la cadena dejando en memoria al menos los
+ * últimos horizon bloques. Se quitan trozos enteros, así que quedan
+ * como mucho horizon + CHAIN_CHUNK - 1. Antes de soltarlos, si hay
+ * almacén, los bloques podados válidos se escriben en él. La instantánea
+ * de la cadena pasa a ser la del último bloque podado.
+ * 
+ * @param chain Cadena.
+ * @param horizon Bloques a conservar, al menos 1.
+ * @param store Almacén abierto para añadir, o NULL.
+ * @return long int Bloques podados, -1 si ERR.
+ */
+long int chain_prune(Chain *chain, long int horizon, block_store *store);
+
+/**
+ * @brief Función que devuelve una referencia más a unas wallets.
+ * 
+ * @param w Wallets (puede ser NULL).
+ * @return wallet_set* Las mismas wallets.
+ */
+wallet_set *wallets_ref(wallet_set *w);
+
+/**
+ * @brief Función que suelta una referencia a unas wallets. Al soltar
+ * la última, las wallets y las páginas que solo usaban ellas vuelven al pool.
+ * 
+ * @param w Wallets (puede ser NULL).
+ */
+void wallets_unref(wallet_set *w);
+
+/**
+ * @brief Función que hace que *dest apunte a src, soltando las anteriores.
+ * 
+ * @param dest Wallets destino.
+ * @param src Wallets origen.
+ */
+void wallets_assign(wallet_set **dest, wallet_set *src);
+
+/**
+ * @brief Función que devuelve el saldo de una wallet.
+ * 
+ * @param w Wallets.
+ * @param i Índice de la wallet.
+ * @return int Saldo, 0 si i no es válido.
+ */
+int wallets_get(const wallet_set *w, int i);
+
+/**
+ * @brief Función que cambia el saldo de una wallet. Si las wallets o
+ * la página están compartidas se copian antes (copy-on-write).
+ * 
+ * @param w Wallets a modificar.
+ * @param i Índice de la wallet.
+ * @param value Saldo nuevo.
+ * @return int 0 OK, -1 ERR.
+ */
+int wallets_set(wallet_set **w, int i, int value);
+
+/**
+ * @brief Función que busca la siguiente wallet con saldo, saltando
+ * los directorios y páginas que no existen.
+ * 
+ * @param w Wallets.
+ * @param i Índice desde el que buscar (incluido).
+ * @return int Índice, -1 si no hay más.
+ */
+int wallets_next(const wallet_set *w, int i);
+
+/**
+ * @brief Función que reserva de antemano los slabs necesarios
+ * para num_blocks bloques y sus wallets. Si no se llama, el primer
+ * block_ini reserva el primer slab.
+ * 
+ * @param num_blocks Número de bloques a reservar.
+ * @return int 0 OK, -1 ERR.
+ */
+int block_pool_ini(int num_blocks);
+
+/**
+ * @brief Función que libera todos los slabs de bloques y wallets.
+ * Los bloques que aún estén en uso dejan de ser válidos.
+ */
+void block_pool_destroy();
+
+/**
+ * @brief Función para obtener un bloque libre del pool. Si no
+ * quedan, reserva otro slab con mmap. El bloque empieza sin
+ * wallets (todas a cero) y sin enlaces.
  * 
  * @return Block* Bloque creado.
  */
@@ -55,7 +451,8 @@ Block *block_ini();
 
 /**
  * @brief Función para inicializar el bloque.
- * El target del nuevo bloque es la solución del anterior.
+ * El target del nuevo bloque es la solución del anterior, comparte
+ * sus wallets y queda enlazado detrás de él.
  * 
  * @param prev Bloque anterior (o perteneciente a la blockchain).
  * @param block Bloque a inicializar.
@@ -65,6 +462,7 @@ int block_set(Block *prev, Block *block);
 
 /**
  * @brief Función para copiar la información de un bloque en otro.
+ * Las wallets se comparten, así que es O(1).
  * 
  * @param src Bloque del que copiar.
  * @param dest Bloque al que copiar.
@@ -73,7 +471,9 @@ int block_set(Block *prev, Block *block);
 int block_copy(Block *src, Block *dest);
 
 /**
- * @brief Función para destruir un bloque.
+ * @brief Función para destruir un bloque. El bloque vuelve al pool
+ * y suelta su referencia a las wallets. No vale para los bloques de
+ * una Chain, que se quitan con chain_pop o chain_destroy.
  * 
  * @param block Bloque a destruir.
  */
@@ -109,7 +509,8 @@ void close_shared_block_info(shared_block_info *sbi);
 
 /**
  * @brief Función para actualizar un bloque local obteniendo
- * los datos de la memoria compartida.
+ * los datos de la memoria compartida. De las wallets solo cambia
+ * la del ganador.
  * 
  * @param sbi Memoria compartida.
  * @param block Bloque local.
@@ -117,6 +518,27 @@ void close_shared_block_info(shared_block_info *sbi);
  */
 short update_block(shared_block_info *sbi, Block *block);
 
+/**
+ * @brief Función que aplana un bloque para enviarlo a otro proceso.
+ * 
+ * @param block Bloque.
+ * @param rec Bloque plano.
+ * @return int 0 OK, -1 ERR.
+ */
+int block_to_record(const Block *block, block_record *rec);
+
+/**
+ * @brief Función que rellena un bloque a partir de uno plano. Las
+ * wallets parten de las de prev (o de las que ya tenga el bloque si
+ * prev es NULL) y solo cambia la del ganador. No enlaza el bloque.
+ * 
+ * @param rec Bloque plano.
+ * @param prev Bloque anterior, NULL si no hay.
+ * @param block Bloque a rellenar.
+ * @return int 0 OK, -1 ERR.
+ */
+int block_from_record(const block_record *rec, const Block *prev, Block *block);
+
 /**
  * @brief Función para imprimir la blockchain en un archivo.
  * 
@@ -0,0 +1,207 @@
+/**
+ * @file hash_index.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifican las funciones del índice
+ * inverso de simple_hash.
+ * @version 0.1 - Índice inverso.
+ * @date 2021-05-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "hash_index.h"
+
+typedef struct {
+    uint32_t *table;
+    long int start;
+    long int end;
+} build_job;
+
+/**
+ * @brief Función que ejecuta cada hilo al construir el índice.
+ * Rellena table[simple_hash(n)] = n para n en [start, end), calculando
+ * el hash de forma incremental.
+ *
+ * @param arg build_job.
+ * @return void* NULL
+ */
+static void *build_thread(void *arg) {
+    build_job *job = (build_job *)arg;
+    long int h = simple_hash(job->start), step = BIG_X % PRIME;
+
+    for (long int n = job->start; n < job->end; n++) {
+        job->table[h] = (uint32_t)n;
+        h += step;
+        if (h >= PRIME) h -= PRIME;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Función que comprueba que la cabecera es de un índice
+ * completo construido con la misma función hash.
+ *
+ * @param header Cabecera.
+ * @return int 1 si es válida, 0 si no.
+ */
+static int header_valid(const index_header *header) {
+    return memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+        && header->version == INDEX_VERSION
+        && header->entry_size == sizeof(uint32_t)
+        && header->prime == PRIME
+        && header->big_x == BIG_X
+        && header->big_y == BIG_Y
+        && header->count == PRIME;
+}
+
+int index_build(const char *path, int num_threads) {
+    size_t size = INDEX_HEADER_SIZE + (size_t)PRIME*sizeof(uint32_t);
+    char tmp_path[4096];
+    void *map = NULL;
+    int fd = -1, err = 0, created = 0;
+
+    if (path == NULL) return -1;
+    if (num_threads <= 0) num_threads = 1;
+
+    /* Si otro proceso ya lo ha construido no hacemos nada */
+    hash_index *idx = index_open(path);
+    if (idx != NULL) {
+        index_close(idx);
+        return 0;
+    }
+
+    /* Construimos en un fichero temporal propio de este proceso */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        unlink(tmp_path);
+        return -1;
+    }
+
+    pthread_t *threads = (pthread_t *)malloc(num_threads*sizeof(pthread_t));
+    build_job *jobs = (build_job *)malloc(num_threads*sizeof(build_job));
+    if (threads == NULL || jobs == NULL) {
+        perror("malloc");
+        free(threads);
+        free(jobs);
+        munmap(map, size);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* Cada hilo rellena las entradas de un trozo de candidatos */
+    for (int i = 0; i < num_threads; i++) {
+        jobs[i].table = (uint32_t *)((char *)map + INDEX_HEADER_SIZE);
+        jobs[i].start = (long int)PRIME*i/num_threads;
+        jobs[i].end = (long int)PRIME*(i+1)/num_threads;
+        err = pthread_create(&threads[i], NULL, build_thread, (void *)&jobs[i]);
+        if (err != 0) {
+            fprintf(stderr, "Error creando threads. pthread_create: %s\n", strerror(err));
+            break;
+        }
+        created++;
+    }
+    for (int i = 0; i < created; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    free(jobs);
+
+    if (err != 0) {
+        munmap(map, size);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* La cabecera se escribe al final, cuando la tabla está completa */
+    index_header *header = (index_header *)map;
+    memset(header, 0, INDEX_HEADER_SIZE);
+    header->version = INDEX_VERSION;
+    header->entry_size = sizeof(uint32_t);
+    header->prime = PRIME;
+    header->big_x = BIG_X;
+    header->big_y = BIG_Y;
+    header->count = PRIME;
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+    if (msync(map, size, MS_SYNC) == -1) perror("msync");
+    munmap(map, size);
+
+    if (rename(tmp_path, path) == -1) {
+        perror("rename");
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+hash_index *index_open(const char *path) {
+    hash_index *idx = NULL;
+    struct stat st;
+    void *map = NULL;
+    int fd = -1;
+
+    if (path == NULL) return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size != INDEX_HEADER_SIZE + (size_t)PRIME*sizeof(uint32_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (!header_valid((const index_header *)map)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    idx = (hash_index *)malloc(sizeof(hash_index));
+    if (idx == NULL) {
+        perror("malloc");
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    idx->map = map;
+    idx->size = st.st_size;
+    idx->preimage = (const uint32_t *)((const char *)map + INDEX_HEADER_SIZE);
+    idx->count = PRIME;
+
+    return idx;
+}
+
+long int index_lookup(const hash_index *idx, long int target) {
+    if (idx == NULL || target < 0 || (uint64_t)target >= idx->count) return -1;
+    return idx->preimage[target];
+}
+
+void index_close(hash_index *idx) {
+    if (idx == NULL) return;
+
+    munmap(idx->map, idx->size);
+    free(idx);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file hash_index.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos de las funciones
+ * del índice inverso de simple_hash. simple_hash es una biyección
+ * sobre [0, PRIME), así que se puede guardar para cada hash su
+ * único candidato y resolver un target con una sola lectura.
+ *
+ * Formato del fichero (little endian, tal cual se escribe en memoria):
+ *      [0, INDEX_HEADER_SIZE)  index_header, relleno con ceros.
+ *      [INDEX_HEADER_SIZE, +4*PRIME)  uint32_t preimage[PRIME], donde
+ *                              preimage[h] es el candidato cuyo hash es h.
+ * La cabecera guarda PRIME, BIG_X y BIG_Y para no usar un índice
+ * construido con otra función. El fichero se construye con otro nombre
+ * y se renombra al final, así nunca se abre un índice a medias.
+ * @version 0.1 - Índice inverso.
+ * @date 2021-05-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trabajador.h"
+
+/* El fichero lo elige quien lo usa (-i). En /dev/shm el índice vive en
+memoria y lo comparten todos los procesos */
+#define INDEX_MAGIC "SHINDEX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t prime;
+    uint64_t big_x;
+    uint64_t big_y;
+    uint64_t count;
+} index_header;
+
+typedef struct {
+    void *map;
+    size_t size;
+    const uint32_t *preimage;
+    uint64_t count;
+} hash_index;
+
+/**
+ * @brief Función que construye el índice en paralelo y lo deja
+ * en path. Si ya existe uno válido no hace nada.
+ *
+ * @param path Fichero del índice.
+ * @param num_threads Hilos que lo construyen.
+ * @return int 0 OK, -1 ERR.
+ */
+int index_build(const char *path, int num_threads);
+
+/**
+ * @brief Función que mapea un índice ya construido en solo lectura.
+ *
+ * @param path Fichero del índice.
+ * @return hash_index* Índice, NULL si no existe o no es válido.
+ */
+hash_index *index_open(const char *path);
+
+/**
+ * @brief Función que devuelve el candidato cuyo hash es target.
+ *
+ * @param idx Índice.
+ * @param target Hash buscado.
+ * @return long int Candidato, -1 si target está fuera de [0, PRIME).
+ */
+long int index_lookup(const hash_index *idx, long int target);
+
+/**
+ * @brief Función que desmapea el índice.
+ *
+ * @param idx Índice a cerrar.
+ */
+void index_close(hash_index *idx);
+
+#endif
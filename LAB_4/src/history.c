@@ -0,0 +1,154 @@
+/**
+ * @file history.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifica el histórico de saldos.
+ * @version 0.1 - Histórico de saldos por altura.
+ * @date 2021-05-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "history.h"
+
+/**
+ * @brief Función que devuelve cuántos ids de la lista son <= id.
+ */
+static int count_until(const history_wallet *hw, int id) {
+    int lo = 0, hi = hw->len;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (hw->ids[mid] <= id) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Función que devuelve la lista de una wallet, creándola si
+ * no existe.
+ */
+static history_wallet *get_wallet(balance_history *h, int wallet) {
+    if (h->wallets[wallet] == NULL) {
+        h->wallets[wallet] = (history_wallet *)calloc(1, sizeof(history_wallet));
+        if (h->wallets[wallet] == NULL) perror("calloc");
+    }
+
+    return h->wallets[wallet];
+}
+
+balance_history *history_ini() {
+    balance_history *h = (balance_history *)calloc(1, sizeof(balance_history));
+
+    if (h == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    h->first_id = -1;
+
+    return h;
+}
+
+int history_add(balance_history *h, const block_record *rec) {
+    history_wallet *hw = NULL;
+
+    if (h == NULL || rec == NULL) return -1;
+    if (rec->is_valid != 1 || rec->winner < 0 || rec->winner >= WALLET_MAX) return 0;
+
+    if (h->first_id == -1) h->first_id = rec->id;
+
+    hw = get_wallet(h, rec->winner);
+    if (hw == NULL) return -1;
+
+    /* Copias repetidas o atrasadas del mismo bloque */
+    if (hw->len > 0 && rec->id <= hw->ids[hw->len - 1]) return 0;
+
+    if (hw->len == hw->cap) {
+        int cap = hw->cap == 0 ? HISTORY_MIN : 2*hw->cap;
+        int *ids = (int *)realloc(hw->ids, cap*sizeof(int));
+        if (ids == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        hw->ids = ids;
+
+        int *balances = (int *)realloc(hw->balances, cap*sizeof(int));
+        if (balances == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        hw->balances = balances;
+        hw->cap = cap;
+    }
+
+    /* El saldo inicial es el de antes de su primera victoria, el
+    registro manda sobre lo que se sembró */
+    if (hw->len == 0) hw->base = rec->balance - 1;
+
+    hw->ids[hw->len] = rec->id;
+    hw->balances[hw->len] = rec->balance;
+    hw->len++;
+
+    return 0;
+}
+
+int history_seed(balance_history *h, int wallet, int balance) {
+    history_wallet *hw = NULL;
+
+    if (h == NULL || wallet < 0 || wallet >= WALLET_MAX) return -1;
+
+    hw = get_wallet(h, wallet);
+    if (hw == NULL) return -1;
+    if (hw->len == 0) hw->base = balance;
+
+    return 0;
+}
+
+int history_balance(const balance_history *h, int wallet, int id, int *balance) {
+    const history_wallet *hw = NULL;
+    int k = 0;
+
+    if (h == NULL || balance == NULL || wallet < 0 || wallet >= WALLET_MAX) return -1;
+    if (h->first_id == -1 || id < h->first_id) return -1;
+
+    /* Una wallet que nunca ha aparecido no ha cobrado nada */
+    hw = h->wallets[wallet];
+    if (hw == NULL) {
+        *balance = 0;
+        return 0;
+    }
+
+    k = count_until(hw, id);
+    *balance = k == 0 ? hw->base : hw->balances[k - 1];
+
+    return 0;
+}
+
+int history_rewards(const balance_history *h, int wallet, int from, int to) {
+    const history_wallet *hw = NULL;
+
+    if (h == NULL || wallet < 0 || wallet >= WALLET_MAX || from > to) return -1;
+
+    /* Antes del histórico no sabemos cuántas cobró, mejor no dar
+    una cuenta a medias */
+    if (h->first_id == -1 || from < h->first_id) return -1;
+
+    hw = h->wallets[wallet];
+    if (hw == NULL) return 0;
+
+    return count_until(hw, to) - count_until(hw, from - 1);
+}
+
+void history_destroy(balance_history *h) {
+    if (h == NULL) return;
+
+    for (int i = 0; i < WALLET_MAX; i++) {
+        if (h->wallets[i] == NULL) continue;
+        free(h->wallets[i]->ids);
+        free(h->wallets[i]->balances);
+        free(h->wallets[i]);
+    }
+    free(h);
+}
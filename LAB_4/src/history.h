@@ -0,0 +1,103 @@
+/**
+ * @file history.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos del histórico de
+ * saldos: el saldo de una wallet en cualquier bloque sin recorrer la
+ * cadena. Cada bloque paga una moneda a un único ganador y el registro
+ * ya trae su saldo acumulado, así que por wallet basta con la lista
+ * ordenada de los ids de los bloques que ganó y el saldo tras cada
+ * uno (sumas prefijas ya calculadas). El saldo en un bloque y las
+ * recompensas en un rango de ids son una búsqueda binaria, O(log n).
+ * @version 0.1 - Histórico de saldos por altura.
+ * @date 2021-05-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "block.h"
+
+/* Capacidad inicial de la lista de cada wallet */
+#define HISTORY_MIN 16
+
+typedef struct {
+    int len;
+    int cap;
+    int base;       /* Saldo antes de la primera victoria */
+    int *ids;       /* Ids de los bloques ganados, crecientes */
+    int *balances;  /* Saldo tras cada uno */
+} history_wallet;
+
+typedef struct {
+    int first_id;   /* Primer bloque conocido, antes no sabemos nada */
+    history_wallet *wallets[WALLET_MAX];
+} balance_history;
+
+/**
+ * @brief Función que crea un histórico vacío.
+ *
+ * @return balance_history* Histórico, NULL si ERR.
+ */
+balance_history *history_ini();
+
+/**
+ * @brief Función que añade un bloque al histórico. Los bloques no
+ * válidos y los que no son posteriores al último del ganador se
+ * ignoran.
+ *
+ * @param h Histórico.
+ * @param rec Bloque.
+ * @return int 0 OK, -1 ERR.
+ */
+int history_add(balance_history *h, const block_record *rec);
+
+/**
+ * @brief Función que fija el saldo de una wallet que aún no ha ganado
+ * ningún bloque del histórico (el que tenía al empezar).
+ *
+ * @param h Histórico.
+ * @param wallet Índice de la wallet.
+ * @param balance Saldo.
+ * @return int 0 OK, -1 ERR.
+ */
+int history_seed(balance_history *h, int wallet, int balance);
+
+/**
+ * @brief Función que devuelve el saldo de una wallet tras un bloque.
+ *
+ * @param h Histórico.
+ * @param wallet Índice de la wallet.
+ * @param id Id del bloque.
+ * @param balance Saldo.
+ * @return int 0 OK, -1 si el bloque es anterior al histórico o la
+ * wallet no se conoce.
+ */
+int history_balance(const balance_history *h, int wallet, int id, int *balance);
+
+/**
+ * @brief Función que devuelve las recompensas de una wallet en los
+ * bloques con id en [from, to].
+ *
+ * @param h Histórico.
+ * @param wallet Índice de la wallet.
+ * @param from Primer id.
+ * @param to Último id.
+ * @return int Recompensas, -1 si ERR o si from es anterior al
+ * histórico.
+ */
+int history_rewards(const balance_history *h, int wallet, int from, int to);
+
+/**
+ * @brief Función que libera el histórico.
+ *
+ * @param h Histórico.
+ */
+void history_destroy(balance_history *h);
+
+#endif
@@ -0,0 +1,232 @@
+/**
+ * @file ledger.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifica el libro de cuentas de la red.
+ * @version 0.1 - Libro de cuentas en memoria compartida.
+ * @date 2021-05-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "ledger.h"
+
+/**
+ * @brief Función que devuelve el tamaño del segmento para capacity wallets.
+ */
+static size_t ledger_size(int capacity) {
+    return LEDGER_HEADER_SIZE + (size_t)(capacity / LEDGER_CHUNK)*sizeof(ledger_chunk);
+}
+
+/**
+ * @brief Función que vuelve a mapear el segmento si ha cambiado de
+ * tamaño desde el último mapa.
+ *
+ * @return int 0 OK, -1 ERR.
+ */
+static int ledger_map(ledger *l) {
+    struct stat seg;
+    void *map = NULL;
+
+    if (fstat(l->fd, &seg) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    if ((size_t)seg.st_size == l->map_size) return 0;
+    if ((size_t)seg.st_size < LEDGER_HEADER_SIZE) {
+        fprintf(stderr, "El libro de cuentas está incompleto.\n");
+        return -1;
+    }
+
+    map = mmap(NULL, seg.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, l->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (l->header != NULL) munmap(l->header, l->map_size);
+
+    l->header = (ledger_header *)map;
+    l->chunks = (ledger_chunk *)((char *)map + LEDGER_HEADER_SIZE);
+    l->map_size = seg.st_size;
+    l->capacity = (seg.st_size - LEDGER_HEADER_SIZE)/sizeof(ledger_chunk)*LEDGER_CHUNK;
+
+    return 0;
+}
+
+/**
+ * @brief Función que se asegura de tener mapeada la wallet i si la
+ * red ya la tiene.
+ *
+ * @return int 0 si i está mapeada, -1 si no.
+ */
+static int ledger_sync(ledger *l, int i) {
+    if (i < 0) return -1;
+    if (i < l->capacity) return 0;
+    if (i >= atomic_load_explicit(&l->header->capacity, memory_order_acquire)) return -1;
+    if (ledger_map(l) == -1) return -1;
+    return i < l->capacity ? 0 : -1;
+}
+
+/**
+ * @brief Función que pone a cero las wallets [from, to).
+ */
+static void ledger_clear(ledger *l, int from, int to) {
+    for (int i = from; i < to; i++) {
+        l->chunks[i / LEDGER_CHUNK].balance[i % LEDGER_CHUNK] = 0;
+        l->chunks[i / LEDGER_CHUNK].last_win[i % LEDGER_CHUNK] = -1;
+    }
+}
+
+ledger *ledger_create(int capacity) {
+    ledger *l = NULL;
+    int fd = -1;
+
+    if (capacity <= 0) capacity = LEDGER_CHUNK;
+    capacity = (capacity + LEDGER_CHUNK - 1)/LEDGER_CHUNK*LEDGER_CHUNK;
+    if (capacity > LEDGER_MAX) {
+        fprintf(stderr, "El libro de cuentas no puede pasar de %d wallets.\n", LEDGER_MAX);
+        return NULL;
+    }
+
+    if ((fd = shm_open(SHM_NAME_LEDGER, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR)) == -1) {
+        /* En el caso de que ya exista nos unimos */
+        if (errno == EEXIST) return ledger_link();
+        perror("shm_open");
+        return NULL;
+    }
+
+    if (ftruncate(fd, ledger_size(capacity)) == -1) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(SHM_NAME_LEDGER);
+        return NULL;
+    }
+
+    l = (ledger *)calloc(1, sizeof(ledger));
+    if (l == NULL) {
+        perror("calloc");
+        close(fd);
+        shm_unlink(SHM_NAME_LEDGER);
+        return NULL;
+    }
+    l->fd = fd;
+
+    if (ledger_map(l) == -1) {
+        close(fd);
+        free(l);
+        shm_unlink(SHM_NAME_LEDGER);
+        return NULL;
+    }
+
+    ledger_clear(l, 0, l->capacity);
+    atomic_init(&l->header->num_users, 1);
+    atomic_store_explicit(&l->header->capacity, l->capacity, memory_order_release);
+
+    return l;
+}
+
+ledger *ledger_link() {
+    ledger *l = NULL;
+    int fd = -1;
+
+    if ((fd = shm_open(SHM_NAME_LEDGER, O_RDWR, 0)) == -1) {
+        perror("shm_open");
+        return NULL;
+    }
+
+    l = (ledger *)calloc(1, sizeof(ledger));
+    if (l == NULL) {
+        perror("calloc");
+        close(fd);
+        return NULL;
+    }
+    l->fd = fd;
+
+    if (ledger_map(l) == -1) {
+        close(fd);
+        free(l);
+        return NULL;
+    }
+    atomic_fetch_add(&l->header->num_users, 1);
+
+    return l;
+}
+
+int ledger_reserve(ledger *l, int capacity) {
+    int old = 0;
+
+    if (l == NULL) return -1;
+
+    capacity = (capacity + LEDGER_CHUNK - 1)/LEDGER_CHUNK*LEDGER_CHUNK;
+    if (capacity > LEDGER_MAX) {
+        fprintf(stderr, "El libro de cuentas no puede pasar de %d wallets.\n", LEDGER_MAX);
+        return -1;
+    }
+
+    old = atomic_load_explicit(&l->header->capacity, memory_order_acquire);
+    if (capacity <= old) return 0;
+
+    if (ftruncate(l->fd, ledger_size(capacity)) == -1) {
+        perror("ftruncate");
+        return -1;
+    }
+    if (ledger_map(l) == -1) return -1;
+
+    /* Los demás solo ven las wallets nuevas cuando ya están a cero */
+    ledger_clear(l, old, capacity);
+    atomic_store_explicit(&l->header->capacity, capacity, memory_order_release);
+
+    return 0;
+}
+
+int ledger_capacity(ledger *l) {
+    if (l == NULL) return -1;
+
+    ledger_sync(l, atomic_load_explicit(&l->header->capacity, memory_order_acquire) - 1);
+    return l->capacity;
+}
+
+int ledger_get(ledger *l, int i) {
+    if (l == NULL || ledger_sync(l, i) == -1) return 0;
+    return l->chunks[i / LEDGER_CHUNK].balance[i % LEDGER_CHUNK];
+}
+
+int ledger_reward(ledger *l, int i, int id) {
+    ledger_chunk *chunk = NULL;
+
+    if (l == NULL || ledger_sync(l, i) == -1) return -1;
+
+    chunk = &l->chunks[i / LEDGER_CHUNK];
+    chunk->last_win[i % LEDGER_CHUNK] = id;
+    return ++chunk->balance[i % LEDGER_CHUNK];
+}
+
+int ledger_to_wallets(ledger *l, wallet_set **w) {
+    int capacity = ledger_capacity(l);
+
+    if (l == NULL || w == NULL) return -1;
+
+    /* Solo leemos el array de saldos de cada trozo */
+    for (int c = 0; c < capacity / LEDGER_CHUNK; c++) {
+        const int32_t *balance = l->chunks[c].balance;
+        for (int k = 0; k < LEDGER_CHUNK; k++)
+            if (balance[k] != 0 && wallets_set(w, c*LEDGER_CHUNK + k, balance[k]) == -1) return -1;
+    }
+
+    return 0;
+}
+
+void ledger_close(ledger *l) {
+    short bool_last = 0;
+
+    if (l == NULL) return;
+
+    if (atomic_fetch_sub(&l->header->num_users, 1) == 1) bool_last = 1;
+
+    munmap(l->header, l->map_size);
+    close(l->fd);
+    free(l);
+
+    /* Si somos los últimos en cerrarlo lo borramos */
+    if (bool_last == 1) shm_unlink(SHM_NAME_LEDGER);
+}
@@ -0,0 +1,138 @@
+/**
+ * @file ledger.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos del libro de
+ * cuentas de la red: el saldo actual de cada wallet en memoria
+ * compartida. Lo crea el primer minero con la capacidad que se pida
+ * y puede crecer después sin mover lo que ya hay: el segmento es una
+ * cabecera seguida de trozos de LEDGER_CHUNK wallets, y cada trozo
+ * guarda sus campos como arrays separados (struct of arrays), así que
+ * recorrer los saldos solo lee saldos. Cuando un proceso crece el
+ * segmento los demás lo vuelven a mapear la próxima vez que lo usan.
+ * Las escrituras se hacen con el mutex de bloques (sems->block_mutex)
+ * y el crecimiento con el de la red (sems->net_mutex).
+ * @version 0.1 - Libro de cuentas en memoria compartida.
+ * @date 2021-05-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "block.h"
+
+#define SHM_NAME_LEDGER "/ledger"
+
+/* Wallets por trozo, la capacidad siempre es múltiplo */
+#define LEDGER_CHUNK 1024
+
+/* Máximo de wallets, las de un bloque no pueden pasar de WALLET_MAX */
+#define LEDGER_MAX WALLET_MAX
+
+#define LEDGER_HEADER_SIZE 64
+
+typedef struct {
+    int32_t balance[LEDGER_CHUNK];
+    int32_t last_win[LEDGER_CHUNK]; /* Id del último bloque cobrado, -1 si ninguno */
+} ledger_chunk;
+
+typedef struct {
+    /* Wallets listas para usar. Se publica después de crecer el
+    segmento y ponerlas a cero, y es lo que mira quien no tiene una
+    wallet en su mapa para saber si tiene que volver a mapear */
+    atomic_int capacity;
+    atomic_int num_users;
+} ledger_header;
+
+typedef struct {
+    int fd;
+    ledger_header *header;
+    ledger_chunk *chunks;
+    int capacity; /* Wallets mapeadas por este proceso */
+    size_t map_size;
+} ledger;
+
+/**
+ * @brief Función que crea el libro de cuentas de la red. Si ya
+ * existe se une a él y capacity no se usa.
+ *
+ * @param capacity Wallets, se redondea a múltiplo de LEDGER_CHUNK.
+ * @return ledger* Libro de cuentas, NULL si ERR.
+ */
+ledger *ledger_create(int capacity);
+
+/**
+ * @brief Función que se une a un libro de cuentas ya creado.
+ *
+ * @return ledger* Libro de cuentas, NULL si ERR.
+ */
+ledger *ledger_link();
+
+/**
+ * @brief Función que hace crecer el libro de cuentas hasta al menos
+ * capacity wallets. Las nuevas empiezan a cero.
+ *
+ * @param l Libro de cuentas.
+ * @param capacity Wallets.
+ * @return int 0 OK, -1 ERR.
+ */
+int ledger_reserve(ledger *l, int capacity);
+
+/**
+ * @brief Función que devuelve el número de wallets del libro.
+ *
+ * @param l Libro de cuentas.
+ * @return int Capacidad, -1 si ERR.
+ */
+int ledger_capacity(ledger *l);
+
+/**
+ * @brief Función que devuelve el saldo de una wallet.
+ *
+ * @param l Libro de cuentas.
+ * @param i Índice de la wallet.
+ * @return int Saldo, 0 si i está fuera del libro.
+ */
+int ledger_get(ledger *l, int i);
+
+/**
+ * @brief Función que paga a una wallet la recompensa de un bloque.
+ *
+ * @param l Libro de cuentas.
+ * @param i Índice de la wallet.
+ * @param id Id del bloque.
+ * @return int Saldo nuevo, -1 si ERR.
+ */
+int ledger_reward(ledger *l, int i, int id);
+
+/**
+ * @brief Función que copia los saldos actuales a unas wallets de
+ * bloque. Sirve para que un proceso que llega tarde empiece su cadena
+ * con los saldos de la red.
+ *
+ * @param l Libro de cuentas.
+ * @param w Wallets destino.
+ * @return int 0 OK, -1 ERR.
+ */
+int ledger_to_wallets(ledger *l, wallet_set **w);
+
+/**
+ * @brief Función que cierra el libro de cuentas. El último proceso
+ * en cerrarlo lo borra.
+ *
+ * @param l Libro de cuentas.
+ */
+void ledger_close(ledger *l);
+
+#endif
@@ -9,6 +9,26 @@
  *          0.3 - Memoria compartida bloques.
  *          0.4 - Red de mineros.
  *          0.5 - Votación y concurrencia.
+ *          0.6 - Pool de trabajadores persistente.
+ *          0.7 - Reparto dinámico por trozos.
+ *          0.8 - Cancelación atómica y estado por línea de caché.
+ *          0.9 - Número de trabajadores automático.
+ *          1.0 - Afinidad de CPU y reparto por nodos NUMA.
+ *          1.1 - Minado especulativo durante la votación.
+ *          1.2 - Índice inverso de simple_hash.
+ *          1.3 - Progreso reanudable por target.
+ *          1.4 - Prueba de trabajo intercambiable.
+ *          1.5 - Pool de bloques sin malloc.
+ *          1.6 - Wallets copy-on-write.
+ *          1.7 - Cadena contigua con acceso por id.
+ *          1.8 - Poda de la cadena con instantánea.
+ *          1.9 - Formato compacto de los mensajes al monitor.
+ *          2.0 - Libro de cuentas compartido.
+ *          2.1 - Índice en la red sin mutex.
+ *          2.2 - Quorum por latidos en memoria compartida.
+ *          2.3 - Aviso de ronda con futex en vez de SIGUSR2.
+ *          2.4 - Recuento de votos sin mutex.
+ *          2.5 - Red de miembros en trozos que crecen.
  * @date 2021-04-27
  * 
  * @copyright Copyright (c) 2021
@@ -16,17 +36,97 @@
  */
 #include "miner.h"
 
-extern int solution_find;
 short sig_int_recibida = 0;
-short sig_usr1_recibida = 0;
-short sig_usr2_recibida = 0;
 short sig_alrm_recibida = 0;
 
 Sems *sems = NULL;
 NetData *net = NULL;
 shared_block_info *sbi = NULL;
 
-Block *block_SIGUSR2 = NULL;
+/* Bloque que actualiza el minero cuando vota como perdedor */
+Block *block_loser = NULL;
+
+/* Última generación de ronda que ha atendido este minero. El hilo
+vigía para a los trabajadores cuando el ganador avisa de otra */
+atomic_uint round_seen = 0;
+atomic_int watcher_stop = 0;
+pthread_t watcher;
+short watcher_started = 0;
+
+/* Saldos actuales de la red, el ganador cobra aquí y el bloque solo
+guarda su saldo nuevo */
+ledger *accounts = NULL;
+
+/* Cadena local del minero y su último bloque. Son globales para que la
+votación parta de sus wallets y solo copie la página que cambia */
+Chain *chain = NULL;
+Block *last_block = NULL;
+
+/* Trabajadores. Son globales para que la votación pueda empezar a
+minar la siguiente ronda mientras se vota */
+worker_pool *pool = NULL;
+worker_struct *threads_info = NULL;
+/* Dos planificadores: el del target que se vota y el de la ronda
+especulativa, para que el progreso del primero siga ahí si la votación
+rechaza el bloque y hay que volver a minarlo */
+range_scheduler scheds[2];
+int sched_last = 0;
+int num_workers = 0;
+long int chunk = DEFAULT_CHUNK;
+
+/* Target que están minando los trabajadores de forma especulativa,
+-1 si no hay ninguna ronda especulativa en marcha */
+long int spec_target = -1;
+
+/* Índice inverso opcional (-i), si está abierto no se usa el pool.
+Solo sirve con el puzzle simple */
+hash_index *idx = NULL;
+
+/**
+ * @brief Función que reparte una ronda nueva a los trabajadores del
+ * pool sin esperar a que terminen. Los trabajadores reclaman trozos
+ * del dominio del puzzle activo al planificador compartido. Si el target
+ * es el de una de las dos últimas rondas se usa su planificador y los
+ * trozos que ya se recorrieron se saltan.
+ * 
+ * @param target Target a minar.
+ * @return int 0 OK, -1 ERR.
+ */
+int start_round(long int target) {
+    range_scheduler *sched = NULL;
+
+    /* Si no es el último pasamos al otro, que es el de ese target o,
+    si no es de ninguno, el más antiguo */
+    if (scheds[sched_last].target != target) sched_last = 1 - sched_last;
+    sched = &scheds[sched_last];
+
+    atomic_store(&solution_find, 0);
+    if (sched_reset(sched, target, pow_domain(), chunk) == -1) return -1;
+    for (int i = 0; i < num_workers; i++) {
+
+        /* Inicializamos las estructuras para los threads */
+        threads_info[i].target = target;
+        threads_info[i].starting_index = 0;
+        threads_info[i].ending_index = pow_domain();
+        threads_info[i].solution = -1;
+        threads_info[i].sched = sched;
+    }
+
+    return pool_start(pool, threads_info);
+}
+
+/**
+ * @brief Función que empieza a minar de forma especulativa el target
+ * de la siguiente ronda (la solución propuesta en esta). Si la votación
+ * acepta el bloque, la siguiente ronda aprovecha el trabajo hecho; si
+ * lo rechaza, se cancela y se descarta.
+ * 
+ * @param next_target Target de la siguiente ronda si el bloque es válido.
+ */
+void start_speculation(long int next_target) {
+    if (idx != NULL || spec_target != -1 || next_target < 0) return;
+    if (start_round(next_target) == 0) spec_target = next_target;
+}
 
 
 /**
@@ -39,35 +139,31 @@ void manejador_SIGINT(int sig) {
     
     /* Como el proceso se va a cerrar, hacemos que los trabajadores
     acaben su ejecución cuanto antes */
-    solution_find = 1;
+    atomic_store(&solution_find, 1);
 
     sig_int_recibida = 1;
 }
 
 /**
- * @brief Manejador de la señal SIGUSR2
- * 
- * @param sig Señal
+ * @brief Función que ejecuta cada minero perdedor cuando el ganador
+ * avisa de una votación en la que participa.
  */
-void manejador_SIGUSR2(int sig) {
+void vote_round() {
     
     /* Para efectuar la votación hacemos que los threads 
     acaben cuanto antes */
-    solution_find = 1;
+    atomic_store(&solution_find, 1);
 
-    sig_usr1_recibida = 0;
-    sig_usr2_recibida = 1;
-
-    block_SIGUSR2 = block_ini();
-    if (block_SIGUSR2 == NULL) {
+    block_loser = block_ini();
+    if (block_loser == NULL) {
         sig_int_recibida = 1; // Para que salga de la ejecución
         return;
     }
+    if (last_block != NULL) wallets_assign(&block_loser->wallets, last_block->wallets);
 
     /* Obtenemos el indice donde nos encontramos */
-    sem_down(&sems->net_mutex);
-    short index = net_get_index(net);
-    sem_up(&sems->net_mutex);
+    int index = net_get_index(net);
+    net_heartbeat(net);
 
     printf("[%d] Soy perdedor\n", index);
 
@@ -76,53 +172,78 @@ void manejador_SIGUSR2(int sig) {
 
     /* 8. El minero comprueba el resultado */
     short result = -1; 
+    long int next_target = -1;
     sem_down(&sems->block_mutex);
-    if (sbi->target == simple_hash(sbi->solution)) result = 1; // Voto positivo
+    if (pow_verify(sbi->target, sbi->solution) == 1) result = 1; // Voto positivo
     else result = 0; // Voto negativo
+    next_target = sbi->solution;
     sem_up(&sems->block_mutex);
 
-    /* 9. El minero introduce su voto */
-    sem_down(&sems->net_mutex);
-    net->voting_pool[index] = result;
-    
-    /* 10. Si somos el último en votar dejamos que cuente los votos el ganador */
-    if (count_votes(net) >= net->total_miners-1) sem_up(&sems->count_votes);
-    sem_up(&sems->net_mutex);
+    /* Mientras se termina la votación minamos ya la siguiente ronda */
+    if (result == 1) start_speculation(next_target);
+
+    /* 9. El minero introduce su voto.
+    10. Si somos el último en votar dejamos que cuente los votos el ganador */
+    if (net_vote(net, result) == net->round_miners-1) sem_up(&sems->count_votes);
 
     sem_down(&sems->update_blocks);
 
     /* 16. Actualizamos nuestro bloque */
     short err = 0;
     sem_down(&sems->block_mutex);
-    if (sbi->is_valid == 1) err = update_block(sbi, block_SIGUSR2);
+    if (sbi->is_valid == 1) err = update_block(sbi, block_loser);
     else {
         /* 15.1 Destruimos el bloque */
-        block_destroy(block_SIGUSR2);
-        block_SIGUSR2 = NULL;
+        block_destroy(block_loser);
+        block_loser = NULL;
+
+        /* El target no cambia, cancelamos el minado especulativo */
+        atomic_store(&solution_find, 1);
     }
     sem_up(&sems->block_mutex);
 
-    /* 17. Dejamos al proceso ganador actualizar el nuevo target */
-    sem_down(&sems->mutex);
-    sem_down(&sems->net_mutex);
-    sems->blocked_loosers += 1;
-    if (net->total_miners-1 == sems->blocked_loosers) {
-        sems->blocked_loosers = 0;
-        sem_post(&sems->update_target);
-    }
-    sem_up(&sems->net_mutex);
-    sem_up(&sems->mutex);
+    /* 17. Si somos el último en actualizar dejamos al proceso ganador
+    actualizar el nuevo target */
+    if (net_loser_done(net) == net->round_miners-1) sem_post(&sems->update_target);
 
     sem_down(&sems->finish);
 }
 
 /**
- * @brief Manejador de la señal SIGUSR1.
+ * @brief Función del hilo vigía: espera en el futex de la red y, si
+ * el ganador avisa de una votación en la que participamos, para a los
+ * trabajadores para que el hilo principal vote cuanto antes. Como se
+ * despierta cada ROUND_WAIT_MS, también late por el minero mientras
+ * el hilo principal espera al pool, que puede tardar más que la
+ * ventana de latidos.
  * 
- * @param sig Señal
+ * @param arg No se usa.
+ */
+void *round_watcher(void *arg) {
+    unsigned int watch = net_round(net);
+
+    while (atomic_load(&watcher_stop) == 0) {
+        net_heartbeat(net);
+        if (net_wait_round(net, watch, ROUND_WAIT_MS) == -1) continue;
+        watch = net_round(net);
+
+        if (atomic_load(&round_seen) != watch && net_in_round(net) == 1)
+            atomic_store(&solution_find, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Función que para el hilo vigía antes de salir de la red.
  */
-void manejador_SIGUSR1(int sig) {
-    sig_usr1_recibida = 1;
+void stop_watcher() {
+    if (watcher_started == 0) return;
+
+    atomic_store(&watcher_stop, 1);
+    net_wake_round(net);
+    pthread_join(watcher, NULL);
+    watcher_started = 0;
 }
 
 /**
@@ -137,33 +258,85 @@ void manejador_SIGALRM(int sig) {
 
 int main(int argc, char *argv[]) {
     long int target = 0;
-    int num_workers = 0, i = 0, err = 0, rounds = 0, infinite = 0;
-
-    pthread_t threads[MAX_WORKERS];
-
-    worker_struct *threads_info = NULL;
-    Block *last_block = NULL, *block = NULL;
+    int i = 0, rounds = 0, infinite = 0, opt = 0, pin = 0;
+    int puzzle = POW_SIMPLE, difficulty = POW_DEFAULT_DIFFICULTY;
+    int *cpus = NULL;
+    char *index_path = NULL, *store_path = NULL;
+    long int horizon = CHAIN_HORIZON;
+    int max_wallets = NET_SHARD_SIZE, window = NET_HEARTBEAT_WINDOW;
+    block_store *store = NULL;
+
+    Block *block = NULL;
     pid_t pid = 0;
     struct timespec ts;
 
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <NUMERO TRABAJADORES> <RONDAS>\n", argv[0]);
+    /* Opciones. Con '+' getopt para en el primer argumento que no es
+    una opción, para que <RONDAS> pueda ser negativo */
+    while ((opt = getopt(argc, argv, "+c:ai:p:d:k:s:m:w:")) != -1) {
+        switch (opt) {
+            case 'c':
+                chunk = atol(optarg);
+                break;
+            case 'a':
+                pin = 1;
+                break;
+            case 'i':
+                index_path = optarg;
+                break;
+            case 'p':
+                puzzle = pow_find(optarg);
+                break;
+            case 'd':
+                difficulty = atoi(optarg);
+                break;
+            case 'k':
+                horizon = atol(optarg);
+                break;
+            case 's':
+                store_path = optarg;
+                break;
+            case 'm':
+                max_wallets = atoi(optarg);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            default:
+                chunk = -1;
+                break;
+        }
+    }
+
+    if (argc - optind != 2 || chunk <= 0 || puzzle == -1 || horizon < 0
+        || max_wallets <= 0 || max_wallets > LEDGER_MAX || window <= 0
+        || difficulty < POW_MIN_DIFFICULTY || difficulty > POW_MAX_DIFFICULTY) {
+        fprintf(stderr, "Usage: %s [-c TAMAÑO_TROZO] [-a] [-i INDICE] [-p simple|sha256] [-d DIFICULTAD] [-k HORIZONTE] [-s ALMACEN] [-m MAX_WALLETS] [-w VENTANA_MS] <NUMERO TRABAJADORES|auto> <RONDAS>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
     
     pid = getpid();
 
+    /* Reservamos los bloques antes de empezar, así la votación los
+    saca del pool sin tocar el heap */
+    if (block_pool_ini(BLOCK_SLAB_SIZE) == -1) {
+        fprintf(stderr, "Error reservando el pool de bloques.\n");
+        exit(EXIT_FAILURE);
+    }
+    chain = chain_ini();
+    if (chain == NULL) {
+        fprintf(stderr, "Error creando la cadena.\n");
+        block_pool_destroy();
+        exit(EXIT_FAILURE);
+    }
+
     /* Inicializamos una máscara para ignorar SIGINT durante la inicialización.
-    Inicializamos también una máscara para esperar SIGUSR2. */
+    Inicializamos también una máscara para esperar al ganador. */
     sigset_t mask, wait_for_winner, ignore_all, waiting_mask;
     sigemptyset(&mask);
     sigfillset(&wait_for_winner);
     sigfillset(&ignore_all);
-    sigdelset(&ignore_all, SIGUSR1);
     sigaddset(&mask, SIGINT);
     sigdelset(&wait_for_winner, SIGINT);
-    sigdelset(&wait_for_winner, SIGUSR1);
-    sigdelset(&wait_for_winner, SIGUSR2);
     sigdelset(&wait_for_winner, SIGALRM);
 
     if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
@@ -172,36 +345,19 @@ int main(int argc, char *argv[]) {
     }
 
     /* Inicializamos las estructuras sigaction */
-    struct sigaction act_SIGINT, act_SIGUSR2, act_SIGUSR1, act_SIGALRM;
+    struct sigaction act_SIGINT, act_SIGALRM;
     act_SIGINT.sa_handler = manejador_SIGINT;
-    act_SIGUSR2.sa_handler = manejador_SIGUSR2;
-    act_SIGUSR1.sa_handler = manejador_SIGUSR1;
     act_SIGALRM.sa_handler = manejador_SIGALRM;
     sigfillset(&(act_SIGINT.sa_mask));
-    sigfillset(&(act_SIGUSR1.sa_mask));
-    sigfillset(&(act_SIGUSR2.sa_mask));
     sigfillset(&(act_SIGALRM.sa_mask));
     act_SIGINT.sa_flags = 0;
-    act_SIGUSR1.sa_flags = 0;
-    act_SIGUSR2.sa_flags = 0;
     act_SIGALRM.sa_flags = 0;
 
-    // Ignoramos la señal SIGUSR2 (ya que el proceso se estará cerrando)
-    sigaddset(&(act_SIGINT.sa_mask), SIGUSR2);
-
     /* Establecemos los manejadores */
     if (sigaction(SIGINT, &act_SIGINT, NULL) < 0) {
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    if (sigaction(SIGUSR1, &act_SIGUSR1, NULL) < 0) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    if (sigaction(SIGUSR2, &act_SIGUSR2, NULL) < 0) {
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
     if (sigaction(SIGALRM, &act_SIGALRM, NULL) < 0) {
         perror("sigaction");
         exit(EXIT_FAILURE);
@@ -223,25 +379,54 @@ int main(int argc, char *argv[]) {
         close_sems(sems);
         exit(EXIT_FAILURE);
     }
+
+    /* El primer minero fija el puzzle de la red, el resto lo adoptan */
+    if (net->pow_id == -1) {
+        net->pow_id = puzzle;
+        net->pow_difficulty = difficulty;
+    }
+
+    /* También fija cuánto puede tardar un minero en latir */
+    if (net->heartbeat_window == -1) net->heartbeat_window = window;
+    pow_select(net->pow_id, net->pow_difficulty);
+    if (net->pow_id != puzzle || net->pow_difficulty != difficulty)
+        printf("La red usa el puzzle %s con dificultad %d, se usará ese.\n", pow_get()->name, pow_difficulty());
+
+    /* El primer minero crea el libro de cuentas, y cada uno se asegura
+    de que cabe su wallet */
+    accounts = ledger_create(max_wallets);
+    if (accounts == NULL || ledger_reserve(accounts, net_get_index(net) + 1) == -1) {
+        fprintf(stderr, "Error al crear/acceder al libro de cuentas.\n");
+        ledger_close(accounts);
+        close_net(net);
+        sem_up(&sems->net_mutex);
+        close_sems(sems);
+        exit(EXIT_FAILURE);
+    }
     sem_up(&sems->net_mutex);
 
     /* Generamos un target aleatorio entre 1 - 1.000.000 */
     srand(time(NULL));
 
-    /* Establecemos un target y el número de trabajadores */
-    num_workers = atoi(argv[1]);
-    rounds = atol(argv[2]);
+    /* Establecemos un target y el número de trabajadores.
+    Con 0 o "auto" usamos un trabajador por CPU disponible */
+    if (strcmp(argv[optind], "auto") == 0) num_workers = 0;
+    else num_workers = atoi(argv[optind]);
+    if (num_workers == 0) num_workers = workers_available();
+    rounds = atol(argv[optind+1]);
 
     /* En caso de que el número de rondas sea infinito */
     if (rounds <= 0) infinite = 1;
 
-    if (num_workers > MAX_WORKERS) {
-        fprintf(stderr, "Número incorrecto de trabajadores. Defina un número entre [1-10] (ambos incluidos).\n");
+    if (num_workers <= 0) {
+        fprintf(stderr, "Número incorrecto de trabajadores. Defina un número mayor que 0, o 0/auto para usar todas las CPUs.\n");
         
         sem_down(&sems->net_mutex);
         close_net(net);
         sem_up(&sems->net_mutex);
 
+        ledger_close(accounts);
+
         close_sems(sems);
 
         exit(EXIT_FAILURE);
@@ -256,15 +441,18 @@ int main(int argc, char *argv[]) {
         close_net(net);
         sem_up(&sems->net_mutex);
 
+        ledger_close(accounts);
+
         close_sems(sems);
         
         exit(EXIT_FAILURE);
     }
 
     /* Reservamos memoria para la estructura usada por los threads  */
-    threads_info = (worker_struct*)malloc(num_workers*(sizeof(worker_struct)));
+    /* Reservamos alineado a la línea de caché para que cada trabajador tenga la suya */
+    threads_info = (worker_struct*)aligned_alloc(CACHE_LINE, num_workers*(sizeof(worker_struct)));
     if (threads_info == NULL) {
-        perror("Error reservando memoria para la estructura de los trabajadores. malloc");
+        perror("Error reservando memoria para la estructura de los trabajadores. aligned_alloc");
         
         sem_down(&sems->net_mutex);
         close_net(net);
@@ -274,23 +462,16 @@ int main(int argc, char *argv[]) {
         close_shared_block_info(sbi);
         sem_up(&sems->block_mutex);
 
+        ledger_close(accounts);
+
         close_sems(sems);
 
         exit(EXIT_FAILURE);
     }
 
-    /* Inicializamos la estructura de la cola de mensajes */
-    struct mq_attr attributes = {
-        .mq_flags = 0,
-        .mq_maxmsg = 10,
-        .mq_curmsgs = 0,
-        .mq_msgsize = sizeof(Mensaje)
-    };
-
     /* Abrimos la cola */
-    mqd_t queue = mq_open(MQ_NAME, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR, &attributes);
+    mqd_t queue = wire_queue_open(MQ_NAME, O_WRONLY);
     if (queue == (mqd_t)-1) {
-        perror("mq_open");
         free(threads_info);
 
         sem_down(&sems->net_mutex);
@@ -304,6 +485,8 @@ int main(int argc, char *argv[]) {
         mq_close(queue);
         mq_unlink(MQ_NAME);
 
+        ledger_close(accounts);
+
         close_sems(sems);
 
         exit(EXIT_FAILURE);
@@ -325,6 +508,8 @@ int main(int argc, char *argv[]) {
         mq_close(queue);
         mq_unlink(MQ_NAME);
 
+        ledger_close(accounts);
+
         close_sems(sems);
 
         exit(EXIT_FAILURE);
@@ -345,23 +530,88 @@ int main(int argc, char *argv[]) {
         mq_close(queue);
         mq_unlink(MQ_NAME);
 
+        ledger_close(accounts);
+
+        close_sems(sems);
+
+        exit(EXIT_FAILURE);
+    }
+
+    /* Con -a fijamos cada trabajador a una CPU. Empezamos el reparto en
+    una posición que depende de nuestro índice en la red, así varios
+    mineros en la misma máquina usan CPUs distintas */
+    if (pin == 1) {
+        int net_index = net_get_index(net);
+
+        cpus = cpu_plan(num_workers, net_index*num_workers);
+        if (cpus == NULL) fprintf(stderr, "No se ha podido calcular la afinidad, los trabajadores no se fijarán.\n");
+    }
+
+    /* Creamos el pool de trabajadores, los hilos se reutilizan en todas las rondas */
+    sched_ini(&scheds[0]);
+    sched_ini(&scheds[1]);
+    pool = pool_ini(num_workers, cpus);
+    free(cpus);
+    cpus = NULL;
+    if (pool == NULL) {
+        fprintf(stderr, "Error creando el pool de trabajadores. pool_ini.\n");
+        free(threads_info);
+
+        sem_down(&sems->net_mutex);
+        close_net(net);
+        sem_up(&sems->net_mutex);
+
+        sem_down(&sems->block_mutex);
+        close_shared_block_info(sbi);
+        sem_up(&sems->block_mutex);
+
+        mq_close(queue);
+        mq_unlink(MQ_NAME);
+
+        ledger_close(accounts);
+
         close_sems(sems);
 
         exit(EXIT_FAILURE);
     }
 
+    /* El vigía hereda la máscara, así que no recibe señales */
+    atomic_store(&round_seen, net_round(net));
+    if (pthread_create(&watcher, NULL, round_watcher, NULL) == 0) watcher_started = 1;
+    else fprintf(stderr, "No se ha podido crear el vigía, los perdedores votarán al acabar su ronda.\n");
+
+    /* Con -i resolvemos con el índice inverso. Si no existe lo construimos
+    con tantos hilos como trabajadores, y si no se puede minamos como siempre */
+    if (index_path != NULL && pow_id() != POW_SIMPLE) {
+        fprintf(stderr, "El índice solo sirve para el puzzle simple, se ignora %s.\n", index_path);
+    } else if (index_path != NULL) {
+        idx = index_open(index_path);
+        if (idx == NULL && index_build(index_path, num_workers) == 0) idx = index_open(index_path);
+        if (idx == NULL) fprintf(stderr, "No se ha podido usar el índice %s, se minará por fuerza bruta.\n", index_path);
+    }
+
+    /* Almacén opcional donde van los bloques podados */
+    if (store_path != NULL) {
+        store = block_store_open(store_path, STORE_APPEND);
+        if (store == NULL) fprintf(stderr, "No se ha podido abrir el almacén %s, los bloques podados se descartarán.\n", store_path);
+    }
+
     /* Ejecutando las rondas correspondientes */
     for (int n = 0; n < rounds || infinite == 1; n++) {
         /* Si la tarea no se completa en 5 segundos salimos */
         alarm(3);
+        net_heartbeat(net);
 
         /* Creamos el bloque */
-        block = block_ini();
+        block = chain_append(chain);
         if (block == NULL) {
-            fprintf(stderr, "Error creando el bloque. block_ini.\n");
+            fprintf(stderr, "Error creando el bloque. chain_append.\n");
+            pool_destroy(pool);
+            index_close(idx);
             free(threads_info);
             
             sem_down(&sems->net_mutex);
+            stop_watcher();
             close_net(net);
             sem_up(&sems->net_mutex);
 
@@ -369,85 +619,55 @@ int main(int argc, char *argv[]) {
             close_shared_block_info(sbi);
             sem_up(&sems->block_mutex);
 
-            block_destroy_blockchain(last_block);
+            chain_destroy(chain);
 
             mq_close(queue);
             mq_unlink(MQ_NAME);
 
-            close_sems(sems);
-
-            exit(EXIT_FAILURE);
-        }
-        if (block_set(last_block, block) == -1) {
-            fprintf(stderr, "Error inicializando el bloque. block_set.\n");
-            free(threads_info);
-            
-            sem_down(&sems->net_mutex);
-            close_net(net);
-            sem_up(&sems->net_mutex);
-
-            sem_down(&sems->block_mutex);
-            close_shared_block_info(sbi);
-            sem_up(&sems->block_mutex);
-
-            block_destroy_blockchain(block);
-
-            mq_close(queue);
-            mq_unlink(MQ_NAME);
+            ledger_close(accounts);
 
             close_sems(sems);
 
             exit(EXIT_FAILURE);
         }
 
+        /* El primer bloque parte de los saldos que ya tiene la red */
+        if (chain_length(chain) == 1 && ledger_to_wallets(accounts, &block->wallets) == -1)
+            fprintf(stderr, "Error copiando los saldos de la red.\n");
+
         sem_down(&sems->block_mutex);
         if (sbi->target != block->target) block->target = sbi->target;
         block->id = sbi->id;
         sem_up(&sems->block_mutex);
 
-        /* Creando threads */
-        for (i = 0; i < num_workers; i++) {
-
-            /* Inicializamos las estructuras para los threads */
-            threads_info[i].target = block->target;
-            threads_info[i].starting_index = i*(PRIME/num_workers);
-            threads_info[i].ending_index = (i+1)*(PRIME/num_workers);
-            threads_info[i].solution = -1;
-            
-            /* Creando los threads */
-            err = pthread_create(&threads[i], NULL, work_thread, (void *)&threads_info[i]);
-            if (err != 0) {
-                perror("Error creando threads. pthread_create");
-                free(threads_info);
-                
-                sem_down(&sems->net_mutex);
-                close_net(net);
-                sem_up(&sems->net_mutex);
-
-                sem_down(&sems->block_mutex);
-                close_shared_block_info(sbi);
-                sem_up(&sems->block_mutex);
-
-                block_destroy_blockchain(block);
-
-                mq_close(queue);
-                mq_unlink(MQ_NAME);
-
-                close_sems(sems);
+        /* Si el almacén es de una red anterior se vacía, si no seguimos detrás */
+        if (chain_length(chain) == 1 && store != NULL && block_store_follow(store, block->id) == -1) {
+            fprintf(stderr, "No se ha podido seguir el almacén %s, los bloques podados se descartarán.\n", store_path);
+            block_store_close(store);
+            store = NULL;
+        }
 
-                exit(EXIT_FAILURE);
+        if (idx != NULL) {
+            /* Con el índice la solución es una sola lectura */
+            for (i = 0; i < num_workers; i++) threads_info[i].solution = -1;
+            threads_info[0].solution = index_lookup(idx, block->target);
+        } else {
+            /* Si hay una ronda especulativa de otro target la cancelamos */
+            if (spec_target != -1 && spec_target != block->target) {
+                atomic_store(&solution_find, 1);
+                pool_wait(pool);
+                spec_target = -1;
             }
-        }
 
-        /* Terminando la ejecución de los threads */
-        short index_ganador = -1;
-        for (i = 0; i < num_workers; i++) {
-            err = pthread_join(threads[i], NULL);
-            if (err != 0) {
-                perror("pthread_join");
+            /* Repartimos la ronda salvo que ya se esté minando este target,
+            y esperamos a que los trabajadores terminen */
+            if ((spec_target == -1 && start_round(block->target) == -1) || pool_wait(pool) == -1) {
+                fprintf(stderr, "Error ejecutando la ronda en el pool de trabajadores.\n");
+                pool_destroy(pool);
                 free(threads_info);
-                
+            
                 sem_down(&sems->net_mutex);
+                stop_watcher();
                 close_net(net);
                 sem_up(&sems->net_mutex);
 
@@ -455,18 +675,26 @@ int main(int argc, char *argv[]) {
                 close_shared_block_info(sbi);
                 sem_up(&sems->block_mutex);
 
-                block_destroy_blockchain(block);
+                chain_destroy(chain);
 
                 mq_close(queue);
                 mq_unlink(MQ_NAME);
 
+                ledger_close(accounts);
+
                 close_sems(sems);
 
                 exit(EXIT_FAILURE);
             }
+            spec_target = -1;
+        }
 
+        short index_ganador = -1;
+        for (i = 0; i < num_workers; i++)
             if (threads_info[i].solution != -1) index_ganador = i;
-        }
+
+        /* Seguimos vivos aunque la ronda haya sido larga */
+        net_heartbeat(net);
 
         /* Comprobamos si alguien ha propuesto una solución */
         short solution_found = 0;
@@ -476,23 +704,37 @@ int main(int argc, char *argv[]) {
         sem_up(&sems->block_mutex);
 
 
-        /* Si la solución ha sido encontrada nos suspendemos esperando SIGUSR2 */
-        /* Hacemos while para que en caso de recibir SIGUSR1 volvamos a suspendernos */
+        /* Dejamos que lleguen SIGINT y SIGALRM si están pendientes. Solo
+        se reciben aquí y mientras esperamos al ganador */
+        pthread_sigmask(SIG_SETMASK, &wait_for_winner, &waiting_mask);
+        pthread_sigmask(SIG_SETMASK, &waiting_mask, NULL);
+
+        /* Si la solución ha sido encontrada esperamos en el futex de la red
+        a que el ganador avise de la votación. Mientras esperamos dejamos
+        pasar SIGINT y SIGALRM, y la espera es corta por si llegan justo
+        antes de dormir */
         while (solution_found == 1 
-            && sig_usr2_recibida == 0 
+            && net_round(net) == atomic_load(&round_seen) 
             && sig_int_recibida == 0 
-            && sig_alrm_recibida == 0) sigsuspend(&wait_for_winner);
-        sig_usr2_recibida = 0;
+            && sig_alrm_recibida == 0) {
+            pthread_sigmask(SIG_SETMASK, &wait_for_winner, &waiting_mask);
+            if (sig_int_recibida == 0 && sig_alrm_recibida == 0)
+                net_wait_round(net, atomic_load(&round_seen), ROUND_WAIT_MS);
+            pthread_sigmask(SIG_SETMASK, &waiting_mask, NULL);
+        }
         sig_alrm_recibida = 0;
+        net_heartbeat(net);
+
+        /* 7. Si hay una votación que no hemos atendido y nos han contado, votamos */
+        if (solution_found == 1 && sig_int_recibida == 0 && net_round(net) != atomic_load(&round_seen)) {
+            atomic_store(&round_seen, net_round(net));
+            if (net_in_round(net) == 1) vote_round();
+        }
 
         /* Abandonamos el bucle principal si se ha recibido SIGINT */
         if (sig_int_recibida == 1) {
-            /* Para no volver a recibir sigusr2 */
-            sem_down(&sems->net_mutex);
-            short index = net_get_index(net);
-            if (net->miners_pid[index] != -1)
-                net->miners_pid[index] = -1;
-            sem_up(&sems->net_mutex);
+            /* Para que no nos vuelvan a contar en el quorum */
+            net_retire(net);
 
             /* Comprobamos que no se nos haya hecho el quorum */
             break;
@@ -500,35 +742,39 @@ int main(int argc, char *argv[]) {
         
         /* G A N A D O R */
         if (solution_found == 0) { 
-            sem_down(&sems->net_mutex);
-            short index = net_get_index(net);
-            sem_up(&sems->net_mutex);
+            int index = net_get_index(net);
 
             printf("[%d] Soy ganador\n", index);
 
             /* 1. El ganador actualiza la solución */
+            long int solution = threads_info[index_ganador].solution;
             sem_down(&sems->block_mutex);
-            sbi->solution = threads_info[index_ganador].solution;
+            sbi->solution = solution;
             sem_up(&sems->block_mutex);
 
+            /* Mientras se vota minamos ya la siguiente ronda */
+            start_speculation(solution);
+
             /* 2. El ganador obtiene el quorum */
-            short quorum = 0;
+            int quorum = 0;
             
-            sem_down(&sems->net_mutex);
             quorum = get_quorum(net);
             if (quorum == -1) {
                 fprintf(stderr, "Error en get_quorum.\n");
                 sig_int_recibida = 1;
             }
-            sem_up(&sems->net_mutex);
-
 
-            /* 3. El ganador actualiza el número de mineros activos. +1 incluyendo al ganador */
+            /* 3. El ganador actualiza el número de mineros de la ronda. +1 incluyendo al ganador */
             sem_down(&sems->net_mutex);
-            net->total_miners = quorum + 1;
+            net->round_miners = quorum + 1;
+            net_reset_votes(net);
 
-            /* 4. El ganador envía SIGUSR2 */
-            if (quorum > 0) send_SIGUSR2(net);
+            /* 4. El ganador avisa a los mineros. Apuntamos antes la ronda
+            como vista para que nuestro vigía no pare la especulación */
+            if (quorum > 0) {
+                atomic_store(&round_seen, net_round(net) + 1);
+                net_announce_round(net);
+            }
             sem_up(&sems->net_mutex);
 
             /* 5. Dejamos que los votantes empiezen a votar */
@@ -545,9 +791,8 @@ int main(int argc, char *argv[]) {
             if (quorum > 0) if (sem_timedwait(&sems->count_votes, &ts) == -1) sig_int_recibida = 1;
 
             /* 11. Contamos los votos */
-            int positive_votes = 0;
+            int positive_votes = net_positive_votes(net);
             sem_down(&sems->net_mutex);
-            for (int k = 0; k < MAX_MINERS; k++) if (net->voting_pool[k] == 1) positive_votes++;
 
             /* 12. Establecemos si es valido el bloque */
             short err = 0;
@@ -564,31 +809,30 @@ int main(int argc, char *argv[]) {
                     /* 13.2 Actualizamos los campos respectivos en la red */
                     net->last_winner = index;
 
-                    /* 13.3 Actualizamos las wallets */
-                    sbi->wallets[index] += 1;
+                    /* 13.3 Pagamos al ganador */
+                    sbi->winner = index;
+                    sbi->balance = ledger_reward(accounts, index, sbi->id);
 
                     /* 13.4 Actualizamos nuestro bloque de forma local */
                     err = update_block(sbi, block);
 
                 } else {
-                    Block *aux = NULL;
-
                     // 13.5 Si no es valido, destruimos el bloque actual
                     sbi->is_valid = 0; 
 
-                    aux = block;
-                    block = aux->prev;
-                    block_destroy(aux);
-                }
+                    /* El target no cambia, cancelamos el minado especulativo */
+                    atomic_store(&solution_find, 1);
 
-                /* Reseteamos la votación */
-                for (int k = 0; k < MAX_MINERS; k++) net->voting_pool[k] = -1;
+                    chain_pop(chain);
+                    block = chain_last(chain);
+                }
             } else {
                 /* En caso de que no haya votantes */
                 sbi->is_valid = 1;
                 net->last_winner = index;
-                sbi->wallets[index] += 1;
                 sbi->id += 1;
+                sbi->winner = index;
+                sbi->balance = ledger_reward(accounts, index, sbi->id);
                 if (update_block(sbi, block) == -1) {
                     fprintf(stderr, "Error en update_block\n");
                     sig_int_recibida = 1;
@@ -623,26 +867,36 @@ int main(int argc, char *argv[]) {
         }
 
         /* El bloque usado en el manejador se guarda en el bloque de la función */
-        if (block_SIGUSR2 != NULL) { 
-            block->is_valid = block_SIGUSR2->is_valid;
-            block->solution = block_SIGUSR2->solution;
-            block->target = block_SIGUSR2->target;
-            for (int i = 0; i < MAX_MINERS; i++) block->wallets[i] = block_SIGUSR2->wallets[i];
-
-            block_destroy(block_SIGUSR2);
-            block_SIGUSR2 = NULL;
+        if (block_loser != NULL) { 
+            block->is_valid = block_loser->is_valid;
+            block->solution = block_loser->solution;
+            block->target = block_loser->target;
+            block->winner = block_loser->winner;
+            wallets_assign(&block->wallets, block_loser->wallets);
+
+            block_destroy(block_loser);
+            block_loser = NULL;
         }
         last_block = block;
 
+        /* Con horizonte la memoria no crece aunque minemos sin parar */
+        if (horizon > 0 && chain_prune(chain, horizon, store) == -1)
+            fprintf(stderr, "Error podando la cadena.\n");
+
         /* Enviamos el bloque al monitor si existe */
         sem_down(&sems->net_mutex);
         if (net->monitor_pid != -1 && block != NULL) {
             Mensaje msg;
+            block_record rec;
+            int len = 0;
             
-            if (block_copy(block, &msg.block) == -1) {
-                fprintf(stderr, "Error en block_copy\n");
+            if (block_to_record(block, &rec) == -1) {
+                fprintf(stderr, "Error en block_to_record\n");
+                pool_destroy(pool);
+                index_close(idx);
                 free(threads_info);
                 
+                stop_watcher();
                 close_net(net);
                 sem_up(&sems->net_mutex);
 
@@ -650,19 +904,27 @@ int main(int argc, char *argv[]) {
                 close_shared_block_info(sbi);
                 sem_up(&sems->block_mutex);
 
-                block_destroy_blockchain(block);
+                chain_destroy(chain);
 
                 mq_close(queue);
                 mq_unlink(MQ_NAME);
 
+                ledger_close(accounts);
+
                 close_sems(sems);
 
                 exit(EXIT_FAILURE); 
             }
-            if(mq_send(queue, (const char *)&msg, sizeof(Mensaje), 0) == -1) {
+
+            len = wire_encode(&rec, msg.data);
+
+            if(mq_send(queue, (const char *)msg.data, len, 0) == -1) {
                 perror("execl");
+                pool_destroy(pool);
+                index_close(idx);
                 free(threads_info);
                 
+                stop_watcher();
                 close_net(net);
                 sem_up(&sems->net_mutex);
 
@@ -670,21 +932,22 @@ int main(int argc, char *argv[]) {
                 close_shared_block_info(sbi);
                 sem_up(&sems->block_mutex);
 
-                block_destroy_blockchain(block);
+                chain_destroy(chain);
 
                 mq_close(queue);
                 mq_unlink(MQ_NAME);
 
+                ledger_close(accounts);
+
                 close_sems(sems);
 
                 exit(EXIT_FAILURE);
             }
         }
         sem_up(&sems->net_mutex);
-        
-        solution_find = 0;
     }
     /* Liberamos recursos */
+    stop_watcher();
     close_net(net);
     sem_up(&sems->net_mutex);
 
@@ -695,10 +958,26 @@ int main(int argc, char *argv[]) {
     mq_close(queue);
     mq_unlink(MQ_NAME);
 
+    ledger_close(accounts);
+
     close_sems(sems);
 
-    //block_destroy_blockchain(last_block);
-    block_destroy_blockchain(block);
+    /* Lo que sigue en memoria también va al almacén, menos el bloque
+    de la ronda interrumpida */
+    for (long int pos = chain_first(chain); store != NULL && pos < chain_length(chain); pos++) {
+        block_record rec;
+        if (chain_at(chain, pos)->is_valid != 1) continue;
+        block_to_record(chain_at(chain, pos), &rec);
+        if (block_store_append(store, &rec) == -1) break;
+    }
+    block_store_close(store);
+
+    chain_destroy(chain);
+    block_pool_destroy();
+    pool_destroy(pool);
+    sched_free(&scheds[0]);
+    sched_free(&scheds[1]);
+    index_close(idx);
     free(threads_info);
     threads_info = NULL;
 
@@ -9,6 +9,11 @@
  *          0.3 - Memoria compartida bloques.
  *          0.4 - Red de mineros.
  *          0.5 - Votación y concurrencia.
+ *          0.6 - Número de trabajadores automático.
+ *          0.7 - Índice inverso de simple_hash.
+ *          0.8 - Prueba de trabajo intercambiable.
+ *          0.9 - Libro de cuentas compartido.
+ *          1.0 - Aviso de ronda con futex en vez de SIGUSR2.
  * @date 2021-04-27
  * 
  * @copyright Copyright (c) 2021
@@ -31,8 +36,12 @@
 #include "net.h"
 #include "sems.h"
 #include "monitor.h"
+#include "hash_index.h"
+#include "pow.h"
+#include "ledger.h"
 
 #define OK 0
-#define MAX_WORKERS 10
-#define MAX_MINERS 200
 #define MQ_NAME "/cola"
+
+/* Espera máxima en el futex de la red antes de volver a mirar las señales */
+#define ROUND_WAIT_MS 100
@@ -5,6 +5,15 @@
  * @brief Archivo donde se codifica el comportamiento 
  * del proceso monitor.
  * @version 0.1 - Monitor
+ *          0.2 - Prueba de trabajo intercambiable.
+ *          0.3 - Pool de bloques sin malloc.
+ *          0.4 - Wallets copy-on-write.
+ *          0.5 - Almacén binario de la cadena.
+ *          0.6 - Cadena contigua con acceso por id.
+ *          0.7 - Poda de la cadena con instantánea.
+ *          0.8 - Formato compacto de los mensajes.
+ *          0.9 - Registros con el ganador y libro de cuentas.
+ *          1.0 - Consultas de saldos históricos.
  * @date 2021-05-03
  * 
  * @copyright Copyright (c) 2021
@@ -34,6 +43,62 @@ void manejador_SIGALRM(int sig) {
     sig_alrm_recibida = 1;
 }
 
+/**
+ * @brief Función que abre (o crea) la cola de consultas de saldos.
+ * 
+ * @return mqd_t Cola, (mqd_t)-1 si ERR.
+ */
+mqd_t open_queries() {
+    struct mq_attr attributes = {
+        .mq_flags = 0,
+        .mq_maxmsg = WIRE_QUEUE_MIN,
+        .mq_curmsgs = 0,
+        .mq_msgsize = sizeof(balance_query)
+    };
+    mqd_t queries = mq_open(MQ_QUERY_NAME, O_RDONLY | O_CREAT | O_NONBLOCK, S_IRUSR | S_IWUSR, &attributes);
+
+    if (queries == (mqd_t)-1) {
+        perror("mq_open");
+        return queries;
+    }
+
+    /* Una cola que ya existía puede ser de otro tamaño */
+    if (mq_getattr(queries, &attributes) == -1 || attributes.mq_msgsize != sizeof(balance_query)) {
+        fprintf(stderr, "La cola %s no admite consultas, bórrela y vuelva a empezar.\n", MQ_QUERY_NAME);
+        mq_close(queries);
+        return (mqd_t)-1;
+    }
+
+    return queries;
+}
+
+/**
+ * @brief Función que responde todas las consultas pendientes con el
+ * histórico de saldos.
+ * 
+ * @param queries Cola de consultas (no bloqueante).
+ * @param history Histórico.
+ */
+void answer_queries(mqd_t queries, const balance_history *history) {
+    balance_query query;
+    char name[64];
+
+    while (mq_receive(queries, (char *)&query, sizeof(balance_query), NULL) == sizeof(balance_query)) {
+        balance_reply reply = {.status = QUERY_OK, .wallet = query.wallet, .from = query.from, .to = query.to};
+
+        if (query.wallet < 0 || query.wallet >= WALLET_MAX || query.from > query.to) reply.status = QUERY_ERROR;
+        else if (history_balance(history, query.wallet, query.to, &reply.balance) == -1) reply.status = QUERY_UNKNOWN;
+        else if ((reply.rewards = history_rewards(history, query.wallet, query.from, query.to)) == -1) reply.status = QUERY_UNKNOWN;
+
+        /* Si el cliente ya no está no hay a quién responder */
+        snprintf(name, sizeof(name), QUERY_REPLY_PREFIX "%d", (int)query.pid);
+        mqd_t replies = mq_open(name, O_WRONLY | O_NONBLOCK);
+        if (replies == (mqd_t)-1) continue;
+        if (mq_send(replies, (const char *)&reply, sizeof(balance_reply), 0) == -1) perror("mq_send");
+        mq_close(replies);
+    }
+}
+
 int main() {
     pid_t pid_padre = 0;
     pid_t pid_hijo = 0;
@@ -42,14 +107,6 @@ int main() {
 
     struct sigaction act_SIGINT, act_SIGALRM;
 
-    /* Inicializamos la estructura de la cola de mensajes */
-    struct mq_attr attributes = {
-        .mq_flags = 0,
-        .mq_maxmsg = 10,
-        .mq_curmsgs = 0,
-        .mq_msgsize = sizeof(Mensaje)
-    };
-
     pid_padre = getpid();
 
     if (pipe(fd) == -1) {
@@ -78,7 +135,16 @@ int main() {
             exit(EXIT_FAILURE);
         }
 
-        Block *last_block = NULL;
+        /* La copia de la cadena es contigua, las wallets salen del pool */
+        if (block_pool_ini(BLOCK_SLAB_SIZE) == -1) {
+            fprintf(stderr, "Error reservando el pool de bloques.\n");
+            exit(EXIT_FAILURE);
+        }
+        Chain *chain = chain_ini();
+        if (chain == NULL) {
+            fprintf(stderr, "Error creando la cadena.\n");
+            exit(EXIT_FAILURE);
+        }
 
         close(fd[1]); /* Cerramos el extremo de escritura */
         time_t next_alrm = time(NULL) + 5;
@@ -88,10 +154,37 @@ int main() {
             perror("read");
             exit(EXIT_FAILURE);
         }
+
+        /* Además del log de texto guardamos la cadena en binario. Se
+        abre para añadir: si el monitor se reinicia con la red en marcha
+        sigue detrás de lo guardado, y si la red es nueva se vacía al
+        llegar su primer bloque */
+        block_store *store = block_store_open(STORE_PATH, STORE_APPEND);
+        if (store == NULL) {
+            fprintf(stderr, "Error al abrir el almacén %s\n", STORE_PATH);
+            fclose(pf);
+            exit(EXIT_FAILURE);
+        }
         alarm(5);
 
+        /* Los mensajes solo traen el saldo del ganador, el resto de
+        saldos del primer bloque salen del libro de cuentas de la red */
+        ledger *accounts = NULL;
+
+        /* Histórico de saldos de todos los bloques recibidos, con él
+        respondemos las consultas sin recorrer el almacén */
+        balance_history *history = history_ini();
+        if (history == NULL) {
+            fprintf(stderr, "Error creando el histórico de saldos.\n");
+            fclose(pf);
+            block_store_close(store);
+            exit(EXIT_FAILURE);
+        }
+        mqd_t queries = open_queries();
+        if (queries == (mqd_t)-1) fprintf(stderr, "No se atenderán consultas de saldos.\n");
+
         while (1) {
-            Block received_block;
+            block_record received_block;
             if (time(NULL) > next_alrm) {
                 alarm(5);
                 next_alrm = time(NULL) + 5;
@@ -99,49 +192,93 @@ int main() {
 
             if (sig_int_recibida == 1) break;
 
+            /* Esperamos a que llegue un bloque o una consulta */
+            struct pollfd fds[2] = {{.fd = fd[0], .events = POLLIN}, {.fd = (int)queries, .events = POLLIN}};
+            if (poll(fds, queries == (mqd_t)-1 ? 1 : 2, -1) == -1) {
+                if (errno == EINTR) continue;
+                perror("poll");
+                fclose(pf);
+                block_store_close(store);
+                ledger_close(accounts);
+                exit(EXIT_FAILURE);
+            }
+            if (queries != (mqd_t)-1 && (fds[1].revents & POLLIN)) answer_queries(queries, history);
+            if (fds[0].revents == 0) continue;
+
             /* Leemos el bloque */
-            int nbytes = read(fd[0], &received_block, sizeof(Block));
+            int nbytes = read(fd[0], &received_block, sizeof(block_record));
             if (errno != EINTR && nbytes == -1) {
                 perror("read");
                 fclose(pf);
+                block_store_close(store);
+                ledger_close(accounts);
                 exit(EXIT_FAILURE);
             }
 
-            /* Hacemos una copia y la guardamos en nuestra cadena dinámica */
+            /* Hacemos una copia y la añadimos al final de nuestra cadena.
+            Sus wallets parten de las del último bloque */
             if (nbytes != -1) {
-                Block *aux = block_ini();
+                Block *aux = chain_append(chain);
                 if (aux == NULL) {
-                    fprintf(stderr, "Error al hacer block_ini\n");
+                    fprintf(stderr, "Error al hacer chain_append\n");
                     fclose(pf);
+                    block_store_close(store);
+                    ledger_close(accounts);
                     exit(EXIT_FAILURE);
                 }
-                if (block_copy(&received_block, aux) == -1) {
-                    fprintf(stderr, "Error en block_copy\n");
+                short first = chain_length(chain) == 1;
+                if (first == 1) {
+                    if (accounts == NULL) accounts = ledger_link();
+                    if (accounts == NULL || ledger_to_wallets(accounts, &aux->wallets) == -1)
+                        fprintf(stderr, "No se han podido leer los saldos de la red, se empieza desde cero.\n");
+                }
+                if (block_from_record(&received_block, aux->prev, aux) == -1) {
+                    fprintf(stderr, "Error en block_from_record\n");
                     fclose(pf);
+                    block_store_close(store);
+                    ledger_close(accounts);
                     exit(EXIT_FAILURE);
                 }
-                
-                if (last_block != NULL) {
-                    last_block->next = aux;
-                    aux->prev = last_block;
-                } else {
-                    aux->prev = NULL;
-                    aux->next = NULL;
+                if ((first == 1 && block_store_follow(store, received_block.id) == -1)
+                    || block_store_append(store, &received_block) == -1) {
+                    fprintf(stderr, "Error en block_store_append\n");
+                    fclose(pf);
+                    block_store_close(store);
+                    ledger_close(accounts);
+                    exit(EXIT_FAILURE);
                 }
-                aux->next = NULL;
-                last_block = aux;
+
+                /* Los que no ganan el primer bloque empiezan con el saldo de la red */
+                if (history_add(history, &received_block) == -1)
+                    fprintf(stderr, "Error añadiendo el bloque %d al histórico.\n", received_block.id);
+                for (int i = wallets_next(aux->wallets, 0); first == 1 && i != -1; i = wallets_next(aux->wallets, i + 1))
+                    history_seed(history, i, wallets_get(aux->wallets, i));
+
+                /* Todos los bloques ya están en el almacén, en memoria
+                solo dejamos los últimos */
+                if (chain_prune(chain, MONITOR_HORIZON, NULL) == -1)
+                    fprintf(stderr, "Error podando la cadena.\n");
+
 
                 if (sig_alrm_recibida == 1) {
                     sig_alrm_recibida = 0;
 
                     /* Escribimos en el archivo */
                     fprintf(pf, "\n########## Mostrando la blockchain. ##########\n");
-                    print_blocks_in_file(pf, last_block);
+                    print_chain_in_file(pf, chain);
                 }
             }
         }
         fclose(pf);
-        block_destroy_blockchain(last_block);
+        block_store_close(store);
+        ledger_close(accounts);
+        history_destroy(history);
+        if (queries != (mqd_t)-1) {
+            mq_close(queries);
+            mq_unlink(MQ_QUERY_NAME);
+        }
+        chain_destroy(chain);
+        block_pool_destroy();
         exit(EXIT_SUCCESS);
     } else { /* Ejecución del padre */
 
@@ -165,6 +302,9 @@ int main() {
             close_sems(sems);
             exit(EXIT_FAILURE);
         }
+
+        /* Verificamos con el mismo puzzle que los mineros */
+        if (net->pow_id != -1) pow_select(net->pow_id, net->pow_difficulty);
         sem_up(&sems->net_mutex);
 
         if(sigaction(SIGINT, &act_SIGINT, NULL) < 0
@@ -177,16 +317,15 @@ int main() {
 
         close(fd[0]); /* Cerramos extremo de lectura */
 
-        Block *buffer_blocks[BUFFER_SIZE]; /* Buffer de bloques */
+        int buffer_blocks[BUFFER_SIZE]; /* Buffer con los ids de los últimos bloques */
         short index = 0;
 
-        /* Inicializamos punteros */
-        for (int i = 0; i < BUFFER_SIZE; i++) buffer_blocks[i] = NULL;
+        /* Inicializamos el buffer */
+        for (int i = 0; i < BUFFER_SIZE; i++) buffer_blocks[i] = -1;
 
         /* Abrimos la cola de mensajes */
-        mqd_t queue = mq_open(MQ_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attributes);
+        mqd_t queue = wire_queue_open(MQ_NAME, O_RDWR);
         if (queue == (mqd_t)-1) {
-            perror("mq_open");
             kill(pid_hijo, SIGINT);
             waitpid(pid_hijo, NULL, 0);
 
@@ -200,11 +339,13 @@ int main() {
 
         while (1) {
             Mensaje msg;
+            block_record rec = {.id = -1};
+            int len = 0;
 
             if (sig_int_recibida == 1) break;
 
             /* Recibimos la instruccion mandada */
-            if (mq_receive(queue, (char *)&msg, sizeof(Mensaje), NULL) == -1){
+            if ((len = mq_receive(queue, (char *)msg.data, sizeof(Mensaje), NULL)) == -1){
                 if (errno != EINTR) {
                     perror("mq_receive");
                     kill(pid_hijo, SIGINT);
@@ -219,51 +360,38 @@ int main() {
                     close_sems(sems);
                     exit(EXIT_FAILURE);
                 }
-                msg.block.id = -1; // Para no actualizar la cadena
+                len = 0; // Para no actualizar la cadena
             }
-            if (msg.block.id != -1) {
+
+            /* Decodificamos el mensaje */
+            if (len > 0 && wire_decode(msg.data, len, &rec) == -1) {
+                fprintf(stderr, "Mensaje mal formado de %d bytes\n", len);
+                rec.id = -1;
+            }
+            if (rec.id != -1) {
                 /* Comprobamos si el bloque ya esta en el buffer */
                 short is_in = 0;
                 for (int i = 0; i < BUFFER_SIZE; i++) 
-                    if (buffer_blocks[i] != NULL) 
-                        if (buffer_blocks[i]->id == msg.block.id) {
-                            is_in = 1;
-                            break;
-                        }
+                    if (buffer_blocks[i] == rec.id) {
+                        is_in = 1;
+                        break;
+                    }
 
                 if (is_in == 1) {
                     /* Imprimimos el mensaje que toque */
-                    if (simple_hash(msg.block.solution) == msg.block.target)
-                        printf("Verified block %d with solution %ld for target %ld\n", msg.block.id, msg.block.solution, msg.block.target);
-                    else printf("Error in block %d with solution %ld for target %ld\n", msg.block.id, msg.block.solution, msg.block.target);
+                    if (pow_verify(rec.target, rec.solution) == 1)
+                        printf("Verified block %d with solution %ld for target %ld\n", rec.id, rec.solution, rec.target);
+                    else printf("Error in block %d with solution %ld for target %ld\n", rec.id, rec.solution, rec.target);
 
                 } else {
                     /* Metemos el bloque en el buffer */
-                    Block b_copy;
-                    block_copy(&msg.block, &b_copy);
-                    buffer_blocks[index] = &b_copy;
+                    buffer_blocks[index] = rec.id;
                     index = (index+1)%BUFFER_SIZE;
                 }
 
-                Block b_copy;
-                if (block_copy(&msg.block, &b_copy) == -1) {
-                    fprintf(stderr, "block_copy\n");
-                    kill(pid_hijo, SIGINT);
-                    waitpid(pid_hijo, NULL, 0);
-
-                    mq_close(queue);
-
-                    sem_down(&sems->net_mutex);
-                    close_net(net);
-                    sem_up(&sems->net_mutex);
-
-                    close_sems(sems);
-                    exit(EXIT_FAILURE);
-                }
-
                 /* Escribimos la copia del bloque en la tubería */
                 if (is_in == 0) { // Si no está lo enviamos
-                    int nbytes = write(fd[1], &b_copy, sizeof(Block));
+                    int nbytes = write(fd[1], &rec, sizeof(block_record));
                     if (nbytes == -1) {
                         kill(pid_hijo, SIGINT);
                         waitpid(pid_hijo, NULL, 0);
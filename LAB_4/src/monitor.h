@@ -5,6 +5,14 @@
  * @brief Archivo donde se definen las cabeceras
  * de las funciones usadas por el monitor.
  * @version 0.1 - Monitor
+ *          0.2 - Prueba de trabajo intercambiable.
+ *          0.3 - Pool de bloques sin malloc.
+ *          0.4 - Wallets copy-on-write.
+ *          0.5 - Almacén binario de la cadena.
+ *          0.6 - Poda de la cadena con instantánea.
+ *          0.7 - Formato compacto de los mensajes.
+ *          0.8 - Libro de cuentas compartido.
+ *          0.9 - Consultas de saldos históricos.
  * @date 2021-05-03
  * 
  * @copyright Copyright (c) 2021
@@ -21,17 +29,57 @@
 #include <time.h>
 #include <string.h>
 #include <wait.h>
+#include <poll.h>
 
 #include "net.h"
 #include "block.h"
 #include "trabajador.h"
 #include "sems.h"
+#include "pow.h"
+#include "wire.h"
+#include "ledger.h"
+#include "history.h"
 
 #define MQ_NAME "/cola"
 #define BUFFER_SIZE 10
 
+/* Almacén binario donde el monitor guarda cada bloque recibido */
+#define STORE_PATH "blockchain.dat"
+
+/* Bloques que el monitor deja en memoria y en el log */
+#define MONITOR_HORIZON CHAIN_HORIZON
+
+/* Mensaje de la cola, codificado con wire_encode */
 typedef struct {
-    Block block;
+    unsigned char data[WIRE_MAX_SIZE];
 } Mensaje;
 
+/* Cola donde el monitor atiende consultas de saldos. La respuesta va
+a la cola QUERY_REPLY_PREFIX<pid> que crea el cliente */
+#define MQ_QUERY_NAME "/consultas"
+#define QUERY_REPLY_PREFIX "/consulta."
+#define QUERY_TIMEOUT 2
+
+/* Estado de la respuesta */
+#define QUERY_OK 0
+#define QUERY_UNKNOWN 1 /* El bloque es anterior al histórico del monitor */
+#define QUERY_ERROR 2
+
+/* Saldo de wallet tras el bloque to y recompensas en [from, to] */
+typedef struct {
+    pid_t pid;
+    int wallet;
+    int from;
+    int to;
+} balance_query;
+
+typedef struct {
+    int status;
+    int wallet;
+    int from;
+    int to;
+    int balance;
+    int rewards;
+} balance_reply;
+
 #endif
\ No newline at end of file
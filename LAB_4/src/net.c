@@ -6,6 +6,12 @@
  * de la red de mineros
  * @version 0.1 - Implementación de la red.
  *          0.2 - Votación y concurrencia.
+ *          0.3 - Prueba de trabajo intercambiable.
+ *          0.4 - Huecos con bitmap atómico e índice en caché.
+ *          0.5 - Latidos en memoria compartida para el quorum.
+ *          0.6 - Aviso de ronda con futex en vez de SIGUSR2.
+ *          0.7 - Recuento de votos con contadores atómicos.
+ *          0.8 - Miembros en trozos que crecen, cada uno con su lock.
  * @date 2021-05-01
  * 
  * @copyright Copyright (c) 2021
@@ -14,6 +20,273 @@
 
 #include "net.h"
 
+/* Hueco de este proceso en la red, -1 si no se ha unido */
+static int net_index = -1;
+
+/* Segmento de miembros mapeado por este proceso, NULL si no lo tiene
+(el monitor no lo mapea) */
+static net_members *members = NULL;
+static net_shard *shards = NULL;
+static int members_fd = -1;
+
+/**
+ * @brief Función que devuelve el reloj monotónico en ms. Es el mismo
+ * para todos los procesos de la máquina.
+ */
+static unsigned long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/**
+ * @brief Función que devuelve el tamaño del segmento de miembros con
+ * num_shards trozos.
+ */
+static size_t members_size(int num_shards) {
+    return NET_MEMBERS_HEADER_SIZE + (size_t)num_shards*sizeof(net_shard);
+}
+
+/**
+ * @brief Función que devuelve el trozo de un hueco de la red.
+ */
+static net_shard *shard_of(int index) {
+    return &shards[index / NET_SHARD_SIZE];
+}
+
+/**
+ * @brief Función que mapea el segmento de miembros con el rango de
+ * todos los trozos posibles. Las páginas que pasan del final del
+ * segmento no se tocan hasta que alguien lo hace crecer.
+ * 
+ * @param fd Descriptor del segmento.
+ * @return int 0 OK, -1 ERR.
+ */
+static int map_members(int fd) {
+    void *map = mmap(NULL, members_size(NET_MAX_SHARDS), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    members = (net_members *)map;
+    shards = (net_shard *)((char *)map + NET_MEMBERS_HEADER_SIZE);
+    members_fd = fd;
+
+    return 0;
+}
+
+/**
+ * @brief Función que deshace el mapa del segmento de miembros.
+ */
+static void unmap_members() {
+    if (members == NULL) return;
+
+    munmap(members, members_size(NET_MAX_SHARDS));
+    close(members_fd);
+    members = NULL;
+    shards = NULL;
+    members_fd = -1;
+}
+
+/**
+ * @brief Función que deja un trozo sin mineros.
+ * 
+ * @return int 0 OK, -1 ERR.
+ */
+static int init_shard(net_shard *sh) {
+    if (sem_init(&sh->lock, 1, 1) == -1) {
+        perror("sem_init");
+        return -1;
+    }
+
+    atomic_init(&sh->used, 0);
+    for (int w = 0; w < NET_SHARD_WORDS; w++) atomic_init(&sh->slots[w], 0);
+    for (int i = 0; i < NET_SHARD_SIZE; i++) {
+        atomic_init(&sh->heartbeat[i], 0);
+        sh->pid[i] = -1;
+        sh->in_round[i] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Función que crea el segmento de miembros con un trozo.
+ * 
+ * @return int 0 OK, -1 ERR.
+ */
+static int create_members() {
+    int fd = -1;
+
+    /* Si quedó uno de una red anterior se vacía */
+    if ((fd = shm_open(SHM_NAME_MEMBERS, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1) {
+        perror("shm_open");
+        return -1;
+    }
+
+    if (ftruncate(fd, members_size(1)) == -1) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(SHM_NAME_MEMBERS);
+        return -1;
+    }
+
+    if (map_members(fd) == -1) {
+        close(fd);
+        shm_unlink(SHM_NAME_MEMBERS);
+        return -1;
+    }
+
+    if (sem_init(&members->grow_mutex, 1, 1) == -1) perror("sem_init");
+    else if (init_shard(&shards[0]) == 0) fd = -1;
+    if (fd != -1) {
+        unmap_members();
+        shm_unlink(SHM_NAME_MEMBERS);
+        return -1;
+    }
+    atomic_store_explicit(&members->num_shards, 1, memory_order_release);
+
+    return 0;
+}
+
+/**
+ * @brief Función que mapea el segmento de miembros ya creado.
+ * 
+ * @return int 0 OK, -1 ERR.
+ */
+static int link_members() {
+    int fd = -1;
+
+    if ((fd = shm_open(SHM_NAME_MEMBERS, O_RDWR, 0)) == -1) {
+        perror("shm_open");
+        return -1;
+    }
+
+    if (map_members(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Función que añade un trozo si el segmento sigue teniendo
+ * seen trozos. Si otro proceso se ha adelantado no hace nada.
+ * 
+ * @param seen Trozos que había al no encontrar hueco.
+ * @return int 0 OK, -1 si ERR o la red está llena.
+ */
+static int grow_members(int seen) {
+    int num_shards = 0, ret = 0;
+
+    if (sem_down(&members->grow_mutex) == -1) return -1;
+
+    num_shards = atomic_load(&members->num_shards);
+    if (num_shards == seen) {
+        if (num_shards == NET_MAX_SHARDS) {
+            fprintf(stderr, "La red no puede pasar de %d mineros.\n", MAX_MINERS);
+            ret = -1;
+        } else if (ftruncate(members_fd, members_size(num_shards + 1)) == -1) {
+            perror("ftruncate");
+            ret = -1;
+        } else if (init_shard(&shards[num_shards]) == -1) {
+            ret = -1;
+        } else {
+            /* Los demás solo ven el trozo nuevo cuando ya está vacío */
+            atomic_store_explicit(&members->num_shards, num_shards + 1, memory_order_release);
+        }
+    }
+
+    sem_up(&members->grow_mutex);
+
+    return ret;
+}
+
+/**
+ * @brief Función que ocupa con nuestro pid el primer hueco libre de
+ * un trozo. El hueco se rellena antes de marcarlo en el bitmap, así
+ * que el quorum nunca ve uno a medias.
+ * 
+ * @param s Trozo.
+ * @return int Índice del hueco en la red, -1 si el trozo está lleno.
+ */
+static int claim_slot(int s) {
+    net_shard *sh = &shards[s];
+    int index = -1;
+
+    /* Los trozos llenos se saltan sin bajar su lock */
+    if (atomic_load(&sh->used) == NET_SHARD_SIZE) return -1;
+    if (sem_down(&sh->lock) == -1) return -1;
+
+    for (int w = 0; w < NET_SHARD_WORDS && index == -1; w++) {
+        unsigned long long used = atomic_load_explicit(&sh->slots[w], memory_order_relaxed);
+        if (~used == 0) continue;
+
+        int i = w*64 + __builtin_ctzll(~used);
+        sh->in_round[i] = 0;
+        sh->pid[i] = getpid();
+        /* No contamos para el quorum hasta el primer latido, que el
+        minero da cuando ya sabe en qué ronda está. Si no, le podrían
+        contar en una votación que nunca verá */
+        atomic_store(&sh->heartbeat[i], 0);
+        atomic_store(&sh->slots[w], used | (1ULL << (i % 64)));
+        atomic_fetch_add(&sh->used, 1);
+        index = s*NET_SHARD_SIZE + i;
+    }
+
+    sem_up(&sh->lock);
+
+    return index;
+}
+
+/**
+ * @brief Función que ocupa un hueco de la red, añadiendo un trozo si
+ * todos están llenos.
+ * 
+ * @param nd Red.
+ * @return int Índice del hueco, -1 si ERR o la red está llena.
+ */
+static int join_slot(NetData *nd) {
+    int index = -1;
+
+    while (index == -1) {
+        int num_shards = atomic_load_explicit(&members->num_shards, memory_order_acquire);
+
+        /* Cada proceso empieza por un trozo distinto, así los que entran
+        a la vez no esperan todos al mismo lock */
+        for (int k = 0; k < num_shards && index == -1; k++)
+            index = claim_slot((getpid() + k) % num_shards);
+
+        if (index == -1 && grow_members(num_shards) == -1) return -1;
+    }
+
+    nd->last_miner = getpid();
+    net_index = index;
+
+    return index;
+}
+
+/**
+ * @brief Función que deja libre nuestro hueco para el siguiente que
+ * entre.
+ */
+static void leave_slot() {
+    net_shard *sh = shard_of(net_index);
+    int i = net_index % NET_SHARD_SIZE;
+
+    sem_down(&sh->lock);
+    atomic_fetch_and(&sh->slots[i / 64], ~(1ULL << (i % 64)));
+    sh->pid[i] = -1;
+    atomic_store(&sh->heartbeat[i], 0);
+    atomic_fetch_sub(&sh->used, 1);
+    sem_up(&sh->lock);
+
+    net_index = -1;
+}
+
 NetData *create_net() {
     NetData *nd = NULL;
     int fd_shm;
@@ -46,15 +319,21 @@ NetData *create_net() {
     nd->last_miner = pid;
     nd->last_winner = -1;
     nd->monitor_pid = -1;
-    
-    /* Inicializando PIDs a -1 */
-    for (int i = 0; i < MAX_MINERS; i++)
-        nd->miners_pid[i] = -1;
-
-    nd->miners_pid[0] = getpid();
-    nd->total_miners = 1;
-    for (int i = 0; i < MAX_MINERS; i++)
-        nd->voting_pool[i] = -1;
+    nd->pow_id = -1;
+    nd->pow_difficulty = -1;
+    nd->heartbeat_window = -1;
+    nd->round_miners = 1;
+    atomic_init(&nd->round_gen, 0);
+    net_reset_votes(nd);
+
+    if (create_members() == -1 || join_slot(nd) == -1) {
+        unmap_members();
+        munmap(nd, sizeof(NetData));
+        shm_unlink(SHM_NAME_MEMBERS);
+        shm_unlink(SHM_NAME_NET);
+        return NULL;
+    }
+    atomic_init(&nd->total_miners, 1);
 
     return nd;
 }
@@ -100,75 +379,154 @@ NetData *link_shared_net() {
         return NULL;
     }
 
-    if (nd->total_miners == MAX_MINERS) {
+    if (link_members() == -1) {
         munmap(nd, sizeof(NetData));
         return NULL;
-    } else {
-        pid_t pid = getpid(); 
-        nd->last_miner = pid;
-        /* Buscamos el primer hueco libre */
-        for (int i = 0; i < MAX_MINERS; i++) {
-            if (nd->miners_pid[i] == -1) {
-                nd->miners_pid[i] = pid;
-                break;
-            }
-        }
-        return nd;
     }
+
+    /* Si no queda ningún hueco ni se puede crecer la red está llena */
+    if (join_slot(nd) == -1) {
+        unmap_members();
+        munmap(nd, sizeof(NetData));
+        return NULL;
+    }
+    atomic_fetch_add(&nd->total_miners, 1);
+
+    return nd;
 }
 
 int net_get_index(NetData *net) {
-    pid_t pid = getpid();
-    int index = -1;
-  
-    for (int i = 0; i < MAX_MINERS; i++) {
-        if (pid == net->miners_pid[i]) {
-            index = i;
-            break;
-        }
-    }
-    
-    return index;
+    return net == NULL ? -1 : net_index;
 }
 
-int get_quorum(NetData *nd) {
-    pid_t pid = -1;
-    int quorum = 0;
+void net_heartbeat(NetData *nd) {
+    if (nd == NULL || net_index == -1) return;
+    atomic_store_explicit(&shard_of(net_index)->heartbeat[net_index % NET_SHARD_SIZE], now_ms(), memory_order_relaxed);
+}
 
-    if (nd == NULL) return -1;
+int net_in_round(NetData *nd) {
+    if (nd == NULL || net_index == -1) return 0;
+    return shard_of(net_index)->in_round[net_index % NET_SHARD_SIZE] == 1;
+}
+
+void net_retire(NetData *nd) {
+    net_shard *sh = NULL;
 
-    pid = getpid();
+    if (nd == NULL || net_index == -1) return;
+
+    sh = shard_of(net_index);
+    sem_down(&sh->lock);
+    sh->pid[net_index % NET_SHARD_SIZE] = -1;
+    sem_up(&sh->lock);
+}
 
-    /* Enviando SIGUSR1 a todos los procesos */
-    for (int i = 0; i < MAX_MINERS; i++) {
-        if (nd->miners_pid[i] != -1 && nd->miners_pid[i] != pid) 
-            if (kill(nd->miners_pid[i], SIGUSR1) != -1) 
-                quorum += 1;
+int get_quorum(NetData *nd) {
+    unsigned long long now = 0, window = 0;
+    int quorum = 0, num_shards = 0;
+
+    if (nd == NULL || members == NULL) return -1;
+
+    now = now_ms();
+    window = nd->heartbeat_window > 0 ? nd->heartbeat_window : NET_HEARTBEAT_WINDOW;
+    num_shards = atomic_load_explicit(&members->num_shards, memory_order_acquire);
+
+    for (int s = 0; s < num_shards; s++) {
+        net_shard *sh = &shards[s];
+
+        /* Un trozo vacío no tiene a nadie que votar. Quien entre en
+        él empieza con in_round a 0 */
+        if (atomic_load(&sh->used) == 0) continue;
+        memset(sh->in_round, 0, sizeof(sh->in_round));
+
+        /* Solo miramos los huecos ocupados del bitmap */
+        for (int w = 0; w < NET_SHARD_WORDS; w++) {
+            unsigned long long used = atomic_load(&sh->slots[w]);
+
+            while (used != 0) {
+                int i = w*64 + __builtin_ctzll(used);
+                used &= used - 1;
+                if (s*NET_SHARD_SIZE + i == net_index || sh->pid[i] == -1) continue;
+
+                /* Un minero colgado deja de latir y sale del quorum. Si
+                ha latido después de leer now, beat > now y no se resta */
+                unsigned long long beat = atomic_load_explicit(&sh->heartbeat[i], memory_order_relaxed);
+                if (beat != 0 && beat + window >= now) {
+                    sh->in_round[i] = 1;
+                    quorum += 1;
+                }
+            }
+        }
     }
 
     return quorum;
 }
 
-void send_SIGUSR2(NetData *nd) {
-    pid_t pid = getpid();
+/**
+ * @brief Función que hace una llamada futex sobre la generación de
+ * ronda. La red es memoria compartida entre procesos, así que no se
+ * puede usar FUTEX_PRIVATE_FLAG.
+ */
+static long futex(atomic_uint *word, int op, unsigned int val, const struct timespec *timeout) {
+    return syscall(SYS_futex, (unsigned int *)word, op, val, timeout, NULL, 0);
+}
 
-    if (nd == NULL) return;
+unsigned int net_round(NetData *nd) {
+    return atomic_load(&nd->round_gen);
+}
+
+unsigned int net_announce_round(NetData *nd) {
+    unsigned int gen = 0;
 
-    /* Enviando SIGUSR2 a todos los procesos activos en la red */
-    for (int i = 0; i < MAX_MINERS; i++)
-        if (nd->miners_pid[i] != -1 && nd->miners_pid[i] != pid) 
-            kill(nd->miners_pid[i], SIGUSR2);
+    if (nd == NULL) return 0;
+
+    /* Una sola llamada despierta a todos los que esperan */
+    gen = atomic_fetch_add(&nd->round_gen, 1) + 1;
+    futex(&nd->round_gen, FUTEX_WAKE, INT_MAX, NULL);
+
+    return gen;
 }
 
-int count_votes(NetData *nd) {
-    int votes = 0;
+int net_wait_round(NetData *nd, unsigned int seen, int timeout_ms) {
+    struct timespec timeout = {.tv_sec = timeout_ms/1000, .tv_nsec = (timeout_ms%1000)*1000000L};
 
     if (nd == NULL) return -1;
 
-    for (int i = 0; i < MAX_MINERS; i++)
-        if (nd->voting_pool[i] != -1) votes++;
+    /* Si la generación ya no es seen el núcleo no nos duerme */
+    if (atomic_load(&nd->round_gen) == seen) futex(&nd->round_gen, FUTEX_WAIT, seen, &timeout);
+
+    return atomic_load(&nd->round_gen) != seen ? 0 : -1;
+}
+
+void net_wake_round(NetData *nd) {
+    if (nd != NULL) futex(&nd->round_gen, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void net_reset_votes(NetData *nd) {
+    if (nd == NULL) return;
 
-    return votes;
+    atomic_store(&nd->votes_yes, 0);
+    atomic_store(&nd->votes_no, 0);
+    atomic_store(&nd->votes_total, 0);
+    atomic_store(&nd->losers_done, 0);
+}
+
+int net_vote(NetData *nd, short vote) {
+    if (nd == NULL) return -1;
+
+    /* El voto se cuenta antes que el total, así quien vea el total
+    completo ve también todos los votos */
+    if (vote == 1) atomic_fetch_add(&nd->votes_yes, 1);
+    else atomic_fetch_add(&nd->votes_no, 1);
+
+    return atomic_fetch_add(&nd->votes_total, 1) + 1;
+}
+
+int net_positive_votes(NetData *nd) {
+    return nd == NULL ? -1 : atomic_load(&nd->votes_yes);
+}
+
+int net_loser_done(NetData *nd) {
+    return nd == NULL ? -1 : atomic_fetch_add(&nd->losers_done, 1) + 1;
 }
 
 void close_net(NetData *nd) {
@@ -179,17 +537,23 @@ void close_net(NetData *nd) {
     /* En caso de ser el monitor solo cambiamos el pid */
     if (getpid() == nd->monitor_pid) {
         nd->monitor_pid = -1;
-        if (nd->total_miners == 0) shm_unlink(SHM_NAME_NET);
+        if (nd->total_miners == 0) {
+            shm_unlink(SHM_NAME_MEMBERS);
+            shm_unlink(SHM_NAME_NET);
+        }
         munmap(nd, sizeof(NetData));
     } else {
-        nd->total_miners -= 1;
-        if (nd->total_miners == 0) bool_borrar = 1;
+        if (atomic_fetch_sub(&nd->total_miners, 1) == 1) bool_borrar = 1;
 
-        int index = net_get_index(nd);
-        if (index != -1) nd->miners_pid[index] = -1;
+        /* Dejamos el hueco libre para el siguiente que entre */
+        if (net_index != -1) leave_slot();
+        unmap_members();
 
         /* En caso de que seamos los últimos en abandonar la red la destruimos */
-        if (bool_borrar == 1 && nd->monitor_pid != -1) shm_unlink(SHM_NAME_NET);
+        if (bool_borrar == 1 && nd->monitor_pid == -1) {
+            shm_unlink(SHM_NAME_MEMBERS);
+            shm_unlink(SHM_NAME_NET);
+        }
 
         munmap(nd, sizeof(NetData));
     }
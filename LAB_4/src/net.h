@@ -7,6 +7,12 @@
  * compartida (la red).
  * @version 0.1 - Implementación de la red
  *          0.2 - Votación y concurrencia.
+ *          0.3 - Prueba de trabajo intercambiable.
+ *          0.4 - Huecos con bitmap atómico e índice en caché.
+ *          0.5 - Latidos en memoria compartida para el quorum.
+ *          0.6 - Aviso de ronda con futex en vez de SIGUSR2.
+ *          0.7 - Recuento de votos con contadores atómicos.
+ *          0.8 - Miembros en trozos que crecen, cada uno con su lock.
  * @date 2021-05-01
  * 
  * @copyright Copyright (c) 2021
@@ -25,17 +31,85 @@
 #include <fcntl.h>
 #include <semaphore.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "sems.h"
 
-#define MAX_MINERS 200
 #define SHM_NAME_NET "/netdata"
 
+/* Miembros de la red. Es un segmento aparte que empieza con un trozo
+y crece de trozo en trozo según entran mineros. Cada proceso reserva
+al unirse el rango de direcciones de NET_MAX_SHARDS trozos, así que
+crecer es solo ftruncate: los trozos nunca se mueven y nadie tiene que
+volver a mapear mientras otro hilo los lee */
+#define SHM_NAME_MEMBERS "/netmembers"
+
+/* Mineros por trozo y palabras de su bitmap de huecos */
+#define NET_SHARD_SIZE 256
+#define NET_SHARD_WORDS (NET_SHARD_SIZE/64)
+
+/* Trozos como mucho, un minero por wallet posible */
+#define NET_MAX_SHARDS 256
+#define MAX_MINERS (NET_SHARD_SIZE*NET_MAX_SHARDS)
+
+#define NET_MEMBERS_HEADER_SIZE 64
+
+/* Milisegundos sin latir tras los que un minero no cuenta para el
+quorum. Tiene que ser mayor que lo que puede tardar una ronda */
+#define NET_HEARTBEAT_WINDOW 5000
+
+typedef struct {
+    /* Entrar y salir de este trozo. El quorum, los latidos y los votos
+    no lo usan */
+    sem_t lock;
+    atomic_int used; /* Huecos ocupados, para saltar trozos llenos sin el lock */
+    /* Bit a 1 si el hueco está ocupado. Se escribe con el lock pero se
+    lee sin él */
+    atomic_ullong slots[NET_SHARD_WORDS];
+    /* Último latido de cada minero en ms (reloj monotónico), 0 si no
+    ha latido. Cada minero solo escribe el suyo */
+    atomic_ullong heartbeat[NET_SHARD_SIZE];
+    pid_t pid[NET_SHARD_SIZE]; /* -1 si el hueco no cuenta para el quorum */
+    /* Mineros que contó el último quorum, los que participan en la votación */
+    char in_round[NET_SHARD_SIZE];
+} net_shard;
+
+typedef struct {
+    /* Trozos ya inicializados. Solo crece, con grow_mutex, y se publica
+    después de inicializar el trozo nuevo. Es lo único que un lector
+    necesita para ver el crecimiento: su mapa ya cubre todos los trozos
+    posibles, así que no hay nada que volver a mapear */
+    atomic_int num_shards;
+    sem_t grow_mutex;
+} net_members;
+
 typedef struct _NetData {
-    pid_t miners_pid[MAX_MINERS];
-    char voting_pool[MAX_MINERS];
+    int heartbeat_window; /* -1 hasta que lo fija el primer minero */
+    /* Mineros que participan en la votación contando al ganador */
+    int round_miners;
+    /* Generación de la ronda, sube cada vez que un ganador pide votar.
+    Es la palabra del futex donde esperan los mineros */
+    atomic_uint round_gen;
+    /* Votos de la ronda. Cada votante suma con una operación atómica y
+    el último lo sabe por el total que le devuelve */
+    atomic_int votes_yes;
+    atomic_int votes_no;
+    atomic_int votes_total;
+    /* Perdedores que ya han actualizado su bloque tras la votación */
+    atomic_int losers_done;
     int last_miner;
-    int total_miners;
+    atomic_int total_miners;
     pid_t monitor_pid;
     pid_t last_winner;
+    /* Puzzle de la red (ver pow.h). Lo fija el primer minero y el
+    resto de mineros y el monitor lo adoptan. -1 si aún no se ha fijado */
+    int pow_id;
+    int pow_difficulty;
 } NetData;
 
 /**
@@ -56,26 +130,54 @@ NetData *link_monitor_net();
 
 /**
  * @brief Función que obtiene una zona de memoria compartida
- * ya creada.
+ * ya creada. Si todos los trozos de miembros están llenos
+ * añade uno.
  * 
- * @return NetData* Zona de memoria compartida con la Red.
+ * @return NetData* Zona de memoria compartida con la Red,
+ * NULL si ERR o si hay MAX_MINERS mineros.
  */
 NetData *link_shared_net();
 
 /**
  * @brief Función para obtener el Indice donde se almacena nuestro PID.
+ * Cada proceso guarda el hueco que reclamó al unirse, así que no hace
+ * falta recorrer la red ni bajar su mutex.
  * 
  * @param nd NetData donde buscar.
- * @return int Indice.
+ * @return int Indice, -1 si no somos un minero de la red.
  */
 int net_get_index(NetData *nd);
 
 /**
- * @brief Función para obtener el quorum. Envía 
- * SIGUSR1 a todos los mineros y comprueba que 
- * envíos son correctos para determinar el número 
- * exacto de mineros activos. Se debe haber bajado
- * el mutex de la red antes de llamar a la función.
+ * @brief Función que apunta que seguimos vivos en nuestro hueco.
+ * 
+ * @param nd Red.
+ */
+void net_heartbeat(NetData *nd);
+
+/**
+ * @brief Función que dice si el último quorum nos contó para votar.
+ * 
+ * @param nd Red.
+ * @return int 1 si votamos, 0 si no.
+ */
+int net_in_round(NetData *nd);
+
+/**
+ * @brief Función que nos saca del quorum sin dejar el hueco, para
+ * que no nos cuenten en las rondas que faltan hasta salir.
+ * 
+ * @param nd Red.
+ */
+void net_retire(NetData *nd);
+
+/**
+ * @brief Función para obtener el quorum. Cuenta los
+ * mineros, sin contarnos a nosotros, que han latido
+ * dentro de la ventana de la red y los marca como
+ * participantes de la ronda. Solo recorre los
+ * bitmaps de los trozos con mineros, sin llamadas al
+ * sistema ni locks.
  *
  * @param nd NetData. 
  * @return int Número de participantes activos.
@@ -83,21 +185,80 @@ int net_get_index(NetData *nd);
 int get_quorum(NetData *nd);
 
 /**
- * @brief Función pensada para que el ganador
- * envíe a todos los participantes de la red, la
- * señal SIGUSR2.
+ * @brief Función que devuelve la generación de ronda actual.
+ * 
+ * @param nd Red.
+ * @return unsigned int Generación.
+ */
+unsigned int net_round(NetData *nd);
+
+/**
+ * @brief Función pensada para que el ganador avise a
+ * todos los mineros de que hay una votación. Sube la
+ * generación y los despierta con una sola llamada
+ * (FUTEX_WAKE), sean cuantos sean. Solo votan los
+ * que contó el último quorum (in_round).
+ * 
+ * @param nd Red.
+ * @return unsigned int Generación nueva.
+ */
+unsigned int net_announce_round(NetData *nd);
+
+/**
+ * @brief Función que espera a que la generación de
+ * ronda deje de ser seen.
+ * 
+ * @param nd Red.
+ * @param seen Última generación vista.
+ * @param timeout_ms Espera máxima en ms.
+ * @return int 0 si ha cambiado, -1 si no (tiempo
+ * agotado o señal).
+ */
+int net_wait_round(NetData *nd, unsigned int seen, int timeout_ms);
+
+/**
+ * @brief Función que despierta a los que esperan la
+ * ronda sin cambiar la generación, para que vuelvan a
+ * mirar sus condiciones de salida.
+ * 
+ * @param nd Red.
+ */
+void net_wake_round(NetData *nd);
+
+/**
+ * @brief Función que pone a cero los votos y los
+ * perdedores que han terminado antes de una votación.
+ * 
+ * @param nd Red.
+ */
+void net_reset_votes(NetData *nd);
+
+/**
+ * @brief Función para votar sin el mutex de la red.
+ * 
+ * @param nd Red.
+ * @param vote 1 si el bloque es válido, 0 si no.
+ * @return int Votos efectuados contando este, -1 si ERR.
+ */
+int net_vote(NetData *nd, short vote);
+
+/**
+ * @brief Función que devuelve los votos positivos.
  * 
  * @param nd Red.
+ * @return int Votos positivos.
  */
-void send_SIGUSR2(NetData *nd);
+int net_positive_votes(NetData *nd);
 
 /**
- * @brief Función para contar los votos efectuados.
+ * @brief Función que apunta sin el mutex de la red que
+ * un perdedor ya ha actualizado su bloque.
  * 
  * @param nd Red.
- * @return int Número de votos.
+ * @return int Perdedores que han terminado contando
+ * este, -1 si ERR.
  */
-int count_votes(NetData *nd);
+int net_loser_done(NetData *nd);
 
 /**
  * @brief Función que cierra la memoria compartida.
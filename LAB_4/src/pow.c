@@ -0,0 +1,76 @@
+/**
+ * @file pow.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifica la elección del puzzle de
+ * la prueba de trabajo.
+ * @version 0.1 - Prueba de trabajo intercambiable.
+ * @date 2021-05-12
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "pow.h"
+#include "sha256.h"
+
+/**
+ * @brief Dominio del puzzle simple.
+ */
+static long int simple_domain() {
+    return PRIME;
+}
+
+/**
+ * @brief Verificación del puzzle simple.
+ */
+static int simple_verify(long int target, long int solution) {
+    return simple_hash(solution) == target;
+}
+
+static const pow_backend backends[] = {
+    [POW_SIMPLE] = {"simple", simple_domain, search_kernel_get, search_kernel_list, simple_verify},
+    [POW_SHA256] = {"sha256", sha256_domain, sha256_kernel_get, sha256_kernel_list, sha256_verify}
+};
+
+static int active = POW_SIMPLE;
+static int active_difficulty = POW_DEFAULT_DIFFICULTY;
+
+int pow_find(const char *name) {
+    if (name == NULL) return -1;
+
+    for (int i = 0; i < (int)(sizeof(backends)/sizeof(backends[0])); i++)
+        if (strcmp(backends[i].name, name) == 0) return i;
+
+    return -1;
+}
+
+int pow_select(int id, int difficulty) {
+    if (id < 0 || id >= (int)(sizeof(backends)/sizeof(backends[0]))) return -1;
+    if (difficulty < POW_MIN_DIFFICULTY || difficulty > POW_MAX_DIFFICULTY) return -1;
+
+    active = id;
+    active_difficulty = difficulty;
+    sha256_set_difficulty(difficulty);
+
+    return 0;
+}
+
+const pow_backend *pow_get() {
+    return &backends[active];
+}
+
+int pow_id() {
+    return active;
+}
+
+int pow_difficulty() {
+    return active_difficulty;
+}
+
+long int pow_domain() {
+    return backends[active].domain();
+}
+
+int pow_verify(long int target, long int solution) {
+    return backends[active].verify(target, solution);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file pow.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos de la prueba de
+ * trabajo. Los trabajadores, los votantes y el monitor no llaman a
+ * ninguna función hash directamente, sino al puzzle activo:
+ *      simple   Buscar n en [0, PRIME) tal que simple_hash(n) == target.
+ *      sha256   Buscar un nonce n tal que SHA-256(target || n) empiece
+ *               por al menos "dificultad" bits a cero. target y n se
+ *               codifican como enteros de 64 bits big endian (16 bytes).
+ * En ambos la solución de un bloque es el target del siguiente.
+ * @version 0.1 - Prueba de trabajo intercambiable.
+ * @date 2021-05-12
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef POW_H
+#define POW_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trabajador.h"
+
+#define POW_SIMPLE 0
+#define POW_SHA256 1
+
+/* Con la dificultad d hacen falta 2^d hashes de media por bloque */
+#define POW_DEFAULT_DIFFICULTY 20
+#define POW_MIN_DIFFICULTY 1
+#define POW_MAX_DIFFICULTY 32
+
+typedef struct {
+    const char *name;
+    /* Los candidatos son [0, domain()) */
+    long int (*domain)();
+    const search_kernel *(*kernel_get)();
+    const search_kernel *(*kernel_list)(int *n);
+    /* 1 si solution resuelve target, 0 si no */
+    int (*verify)(long int target, long int solution);
+} pow_backend;
+
+/**
+ * @brief Función que devuelve el identificador de un puzzle.
+ *
+ * @param name Nombre del puzzle ("simple" o "sha256").
+ * @return int Identificador, -1 si no existe.
+ */
+int pow_find(const char *name);
+
+/**
+ * @brief Función que elige el puzzle con el que trabaja el proceso.
+ * La dificultad solo la usan los puzzles que la tienen (sha256).
+ * Hasta que se llama, el puzzle activo es simple.
+ *
+ * @param id Identificador del puzzle.
+ * @param difficulty Dificultad, entre POW_MIN_DIFFICULTY y POW_MAX_DIFFICULTY.
+ * @return int 0 OK, -1 ERR.
+ */
+int pow_select(int id, int difficulty);
+
+/**
+ * @brief Función que devuelve el puzzle activo.
+ *
+ * @return const pow_backend* Puzzle activo.
+ */
+const pow_backend *pow_get();
+
+/**
+ * @brief Función que devuelve el identificador del puzzle activo.
+ *
+ * @return int Identificador.
+ */
+int pow_id();
+
+/**
+ * @brief Función que devuelve la dificultad activa.
+ *
+ * @return int Dificultad.
+ */
+int pow_difficulty();
+
+/**
+ * @brief Función que devuelve el fin (no incluido) del dominio de
+ * candidatos del puzzle activo.
+ *
+ * @return long int Tamaño del dominio.
+ */
+long int pow_domain();
+
+/**
+ * @brief Función que comprueba una solución con el puzzle activo.
+ *
+ * @param target Target del bloque.
+ * @param solution Solución propuesta.
+ * @return int 1 si es válida, 0 si no.
+ */
+int pow_verify(long int target, long int solution);
+
+#endif
@@ -60,7 +60,6 @@ Sems *sems_ini() {
     /* Inicializando numéro de mineros */
     sem_down(&sems->mutex);
     sems->total_miners = 1;
-    sems->blocked_loosers = 0;
     sem_up(&sems->mutex);
 
     return sems;
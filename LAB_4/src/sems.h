@@ -28,7 +28,6 @@
 
 typedef struct {
     int total_miners;
-    int blocked_loosers;
     sem_t net_mutex;
     sem_t block_mutex;
     sem_t mutex;
@@ -0,0 +1,281 @@
+/**
+ * @file sha256.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifica el puzzle SHA-256 con dificultad
+ * y sus kernels de búsqueda.
+ * @version 0.1 - Prueba de trabajo intercambiable.
+ * @date 2021-05-12
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* Las operaciones de SHA-256 se escriben como macros para que valgan
+igual para uint32_t que para los vectores de GCC (un uint32_t por carril) */
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define BSIG0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define CH(e, f, g) (((e) & (f)) ^ (~(e) & (g)))
+#define MAJ(a, b, c) (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c)))
+
+/* Una ronda t sobre las variables a..h con la palabra de mensaje wt */
+#define ROUND(t, wt) do { \
+        t1 = h + BSIG1(e) + CH(e, f, g) + K[t] + (wt); \
+        t2 = BSIG0(a) + MAJ(a, b, c); \
+        h = g; g = f; f = e; e = d + t1; \
+        d = c; c = b; b = a; a = t1 + t2; \
+    } while (0)
+
+/* Palabras fijas del mensaje: W[4] es el bit de relleno y W[15] la
+longitud (128 bits); W[5..14] son cero */
+#define PAD_WORD 0x80000000u
+#define LEN_WORD 128u
+
+static int difficulty = 20;
+
+/* Un hash cumple si su primera palabra es menor que limit = 2^(32-d) */
+static uint64_t limit = 1UL << 12;
+
+void sha256_set_difficulty(int d) {
+    if (d < 1) d = 1;
+    if (d > 32) d = 32;
+    difficulty = d;
+    limit = 1UL << (32 - d);
+}
+
+long int sha256_domain() {
+    return 1L << (difficulty + 6);
+}
+
+/**
+ * @brief Función que calcula el estado tras las dos primeras rondas,
+ * que solo dependen del target (W[0] y W[1]). Es común a todos los
+ * nonces, así que los kernels la calculan una vez por llamada.
+ *
+ * @param target Target.
+ * @param mid Estado a..h tras la ronda 1.
+ */
+static void sha256_midstate(long int target, uint32_t mid[8]) {
+    uint32_t a = H0[0], b = H0[1], c = H0[2], d = H0[3], e = H0[4], f = H0[5], g = H0[6], h = H0[7];
+    uint32_t t1 = 0, t2 = 0;
+
+    ROUND(0, (uint32_t)((unsigned long)target >> 32));
+    ROUND(1, (uint32_t)target);
+
+    mid[0] = a; mid[1] = b; mid[2] = c; mid[3] = d;
+    mid[4] = e; mid[5] = f; mid[6] = g; mid[7] = h;
+}
+
+/* Cuerpo de la compresión a partir de la ronda 2. Espera declaradas
+a..h, t1, t2 y w[16] del tipo T (escalar o vector) con w[0..15] ya
+cargadas. El mensaje se expande sobre w como una ventana circular. */
+#define SHA256_ROUNDS_FROM_2() do { \
+        for (int t = 2; t < 16; t++) ROUND(t, w[t]); \
+        for (int t = 16; t < 64; t++) { \
+            w[t & 15] += SSIG1(w[(t - 2) & 15]) + w[(t - 7) & 15] + SSIG0(w[(t - 15) & 15]); \
+            ROUND(t, w[t & 15]); \
+        } \
+    } while (0)
+
+void sha256_pow_hash(long int target, long int nonce, uint32_t digest[8]) {
+    uint32_t mid[8], w[16], t1 = 0, t2 = 0;
+
+    sha256_midstate(target, mid);
+    uint32_t a = mid[0], b = mid[1], c = mid[2], d = mid[3], e = mid[4], f = mid[5], g = mid[6], h = mid[7];
+
+    w[0] = (uint32_t)((unsigned long)target >> 32);
+    w[1] = (uint32_t)target;
+    w[2] = (uint32_t)((unsigned long)nonce >> 32);
+    w[3] = (uint32_t)nonce;
+    w[4] = PAD_WORD;
+    for (int t = 5; t < 15; t++) w[t] = 0;
+    w[15] = LEN_WORD;
+
+    SHA256_ROUNDS_FROM_2();
+
+    digest[0] = H0[0] + a; digest[1] = H0[1] + b; digest[2] = H0[2] + c; digest[3] = H0[3] + d;
+    digest[4] = H0[4] + e; digest[5] = H0[5] + f; digest[6] = H0[6] + g; digest[7] = H0[7] + h;
+}
+
+int sha256_verify(long int target, long int solution) {
+    uint32_t digest[8];
+
+    if (solution < 0 || solution >= sha256_domain()) return 0;
+
+    sha256_pow_hash(target, solution, digest);
+    return digest[0] < limit;
+}
+
+/**
+ * @brief Kernel escalar.
+ *
+ * @param start Primer nonce.
+ * @param end Último nonce (no incluido).
+ * @param target Target.
+ * @return long int Nonce que cumple la dificultad, -1 si no hay en el rango.
+ */
+static long int sha256_search_scalar(long int start, long int end, long int target) {
+    uint32_t mid[8], w[16], t1 = 0, t2 = 0;
+    long int i = start, stop = 0;
+
+    if (start >= end) return -1;
+    sha256_midstate(target, mid);
+
+    while (i < end) {
+        if (CANCELLED()) return -1;
+
+        stop = i + SHA256_CANCEL_POLL < end ? i + SHA256_CANCEL_POLL : end;
+        for (; i < stop; i++) {
+            uint32_t a = mid[0], b = mid[1], c = mid[2], d = mid[3], e = mid[4], f = mid[5], g = mid[6], h = mid[7];
+
+            w[0] = (uint32_t)((unsigned long)target >> 32);
+            w[1] = (uint32_t)target;
+            w[2] = (uint32_t)((unsigned long)i >> 32);
+            w[3] = (uint32_t)i;
+            w[4] = PAD_WORD;
+            for (int t = 5; t < 15; t++) w[t] = 0;
+            w[15] = LEN_WORD;
+
+            SHA256_ROUNDS_FROM_2();
+
+            if (H0[0] + a < limit) return i;
+        }
+    }
+
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Vectores de GCC con un uint32_t por carril. Las operaciones entre un
+vector y un escalar se aplican a todos los carriles. */
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+/* Cuerpo de los kernels vectoriales. Cada carril calcula el hash de un
+nonce distinto (i + carril). Si algún carril cumple la dificultad, el
+grupo se vuelve a recorrer de forma escalar para devolver el primero. */
+#define SHA256_SEARCH_LANES(T, LANES) do { \
+        uint32_t mid[8], hi[LANES], lo[LANES]; \
+        long int i = start, stop = 0; \
+        T w[16], t1, t2; \
+        \
+        if (start >= end) return -1; \
+        sha256_midstate(target, mid); \
+        \
+        while (end - i >= LANES) { \
+            if (CANCELLED()) return -1; \
+            \
+            stop = i + SHA256_CANCEL_POLL < end ? i + SHA256_CANCEL_POLL : end; \
+            for (; stop - i >= LANES; i += LANES) { \
+                T a = (T){0} + mid[0], b = (T){0} + mid[1], c = (T){0} + mid[2], d = (T){0} + mid[3]; \
+                T e = (T){0} + mid[4], f = (T){0} + mid[5], g = (T){0} + mid[6], h = (T){0} + mid[7]; \
+                \
+                for (int l = 0; l < LANES; l++) { \
+                    hi[l] = (uint32_t)((unsigned long)(i + l) >> 32); \
+                    lo[l] = (uint32_t)(i + l); \
+                } \
+                w[0] = (T){0} + (uint32_t)((unsigned long)target >> 32); \
+                w[1] = (T){0} + (uint32_t)target; \
+                memcpy(&w[2], hi, sizeof(T)); \
+                memcpy(&w[3], lo, sizeof(T)); \
+                w[4] = (T){0} + PAD_WORD; \
+                for (int t = 5; t < 15; t++) w[t] = (T){0}; \
+                w[15] = (T){0} + LEN_WORD; \
+                \
+                SHA256_ROUNDS_FROM_2(); \
+                \
+                a += H0[0]; \
+                for (int l = 0; l < LANES; l++) \
+                    if (a[l] < limit) return sha256_search_scalar(i, i + LANES, target); \
+            } \
+        } \
+        \
+        return sha256_search_scalar(i, end, target); \
+    } while (0)
+
+/**
+ * @brief Kernel SSE2, 4 nonces a la vez.
+ */
+__attribute__((target("sse2")))
+static long int sha256_search_sse2(long int start, long int end, long int target) {
+    SHA256_SEARCH_LANES(u32x4, 4);
+}
+
+/**
+ * @brief Kernel AVX2, 8 nonces a la vez.
+ */
+__attribute__((target("avx2")))
+static long int sha256_search_avx2(long int start, long int end, long int target) {
+    SHA256_SEARCH_LANES(u32x8, 8);
+}
+
+/**
+ * @brief Kernel AVX-512, 16 nonces a la vez.
+ */
+__attribute__((target("avx512f")))
+static long int sha256_search_avx512(long int start, long int end, long int target) {
+    SHA256_SEARCH_LANES(u32x16, 16);
+}
+
+#endif
+
+static const search_kernel sha256_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"sha256-avx512", 16, sha256_search_avx512},
+    {"sha256-avx2", 8, sha256_search_avx2},
+    {"sha256-sse2", 4, sha256_search_sse2},
+#endif
+    {"sha256-scalar", 1, sha256_search_scalar}
+};
+
+static const search_kernel *selected_kernel = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Elige el mejor kernel que soporta la CPU.
+ */
+static void select_kernel() {
+    int n = sizeof(sha256_kernels)/sizeof(sha256_kernels[0]);
+
+    selected_kernel = &sha256_kernels[n-1];
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) selected_kernel = &sha256_kernels[0];
+    else if (__builtin_cpu_supports("avx2")) selected_kernel = &sha256_kernels[1];
+    else if (__builtin_cpu_supports("sse2")) selected_kernel = &sha256_kernels[2];
+#endif
+}
+
+const search_kernel *sha256_kernel_get() {
+    pthread_once(&kernel_once, select_kernel);
+    return selected_kernel;
+}
+
+const search_kernel *sha256_kernel_list(int *n) {
+    int total = sizeof(sha256_kernels)/sizeof(sha256_kernels[0]);
+    const search_kernel *best = sha256_kernel_get();
+
+    if (n != NULL) *n = total - (int)(best - sha256_kernels);
+    return best;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file sha256.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos del puzzle
+ * SHA-256 con dificultad. El mensaje es un único bloque de 16 bytes
+ * (target y nonce en big endian), así que cada candidato cuesta una
+ * sola compresión. Los kernels vectoriales calculan 4, 8 o 16
+ * compresiones a la vez, una por carril (multi-buffer).
+ * @version 0.1 - Prueba de trabajo intercambiable.
+ * @date 2021-05-12
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#include "trabajador.h"
+
+/* Los kernels de SHA-256 son unas 100 veces más lentos por candidato
+que los de simple_hash, así que miran el token de cancelación más a menudo */
+#define SHA256_CANCEL_POLL (1 << 10)
+
+/**
+ * @brief Función que calcula SHA-256(target || nonce).
+ *
+ * @param target Target.
+ * @param nonce Nonce.
+ * @param digest Donde se guardan las 8 palabras del resumen.
+ */
+void sha256_pow_hash(long int target, long int nonce, uint32_t digest[8]);
+
+/**
+ * @brief Función que fija la dificultad y con ella el dominio.
+ *
+ * @param difficulty Bits a cero que debe tener el resumen.
+ */
+void sha256_set_difficulty(int difficulty);
+
+/**
+ * @brief Función que devuelve el dominio de nonces. Es 64 veces
+ * el número esperado de intentos, así que la probabilidad de que
+ * un target no tenga solución es de e^-64.
+ *
+ * @return long int Fin del dominio (no incluido).
+ */
+long int sha256_domain();
+
+/**
+ * @brief Función que comprueba una solución.
+ *
+ * @param target Target.
+ * @param solution Nonce propuesto.
+ * @return int 1 si es válida, 0 si no.
+ */
+int sha256_verify(long int target, long int solution);
+
+/**
+ * @brief Función que devuelve el kernel más rápido soportado por
+ * la CPU. Se elige una única vez.
+ *
+ * @return const search_kernel* Kernel elegido.
+ */
+const search_kernel *sha256_kernel_get();
+
+/**
+ * @brief Función que devuelve los kernels que soporta la CPU, del
+ * más rápido al más lento (el último siempre es el escalar).
+ *
+ * @param n Donde se guarda el número de kernels.
+ * @return const search_kernel* Array de kernels.
+ */
+const search_kernel *sha256_kernel_list(int *n);
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * @file slab.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifica el reservador de objetos de
+ * tamaño fijo.
+ * @version 0.1 - Wallets copy-on-write.
+ * @date 2021-05-13
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "slab.h"
+
+/* Cabecera de un hueco. next es el índice+1 del siguiente libre (0 si
+no hay), index es el índice global del hueco en el pool. */
+typedef struct {
+    atomic_uint next;
+    uint32_t index;
+} slab_header;
+
+#define HEAD_INDEX(h) ((uint32_t)(h))
+#define HEAD_TAG(h) ((h) >> 32)
+#define HEAD_MAKE(tag, index) (((unsigned long)(tag) << 32) | (index))
+
+/**
+ * @brief Función que devuelve la cabecera del hueco con índice global index.
+ */
+static slab_header *slot_at(slab_pool *pool, uint32_t index) {
+    return (slab_header *)((char *)pool->slabs[index / SLAB_OBJECTS] + (index % SLAB_OBJECTS)*pool->slot_size);
+}
+
+/**
+ * @brief Función que mete un hueco en la pila de libres. La etiqueta
+ * cambia en cada operación para que un pop interrumpido por un
+ * manejador que saca y vuelve a meter el mismo hueco (ABA) falle y
+ * se reintente.
+ */
+static void free_push(slab_pool *pool, slab_header *slot) {
+    unsigned long old = atomic_load_explicit(&pool->free_head, memory_order_relaxed), new = 0;
+
+    do {
+        atomic_store_explicit(&slot->next, HEAD_INDEX(old), memory_order_relaxed);
+        new = HEAD_MAKE(HEAD_TAG(old) + 1, slot->index + 1);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &old, new, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief Función que saca un hueco de la pila de libres.
+ *
+ * @return slab_header* Hueco, NULL si la pila está vacía.
+ */
+static slab_header *free_pop(slab_pool *pool) {
+    unsigned long old = atomic_load_explicit(&pool->free_head, memory_order_acquire), new = 0;
+    slab_header *slot = NULL;
+
+    do {
+        if (HEAD_INDEX(old) == 0) return NULL;
+        slot = slot_at(pool, HEAD_INDEX(old) - 1);
+        new = HEAD_MAKE(HEAD_TAG(old) + 1, atomic_load_explicit(&slot->next, memory_order_relaxed));
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &old, new, memory_order_acquire, memory_order_acquire));
+
+    return slot;
+}
+
+/**
+ * @brief Función que reserva un slab nuevo con mmap y mete todos
+ * sus huecos en la pila de libres. Cada llamada se queda con un
+ * número de slab distinto, así que es segura aunque un manejador
+ * de señal la interrumpa.
+ *
+ * @return int 0 OK, -1 ERR.
+ */
+static int slab_grow(slab_pool *pool) {
+    char *slab = NULL;
+    int k = atomic_fetch_add(&pool->num_slabs, 1);
+
+    if (k >= SLAB_MAX) {
+        atomic_fetch_sub(&pool->num_slabs, 1);
+        fprintf(stderr, "Se ha alcanzado el máximo de %d objetos en el pool.\n", SLAB_MAX*SLAB_OBJECTS);
+        return -1;
+    }
+
+    slab = mmap(NULL, SLAB_OBJECTS*pool->slot_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED) {
+        perror("mmap");
+        pool->slabs[k] = NULL;
+        return -1;
+    }
+    pool->slabs[k] = slab;
+
+    /* Los metemos al revés para que salgan en orden de dirección */
+    for (int j = SLAB_OBJECTS - 1; j >= 0; j--) {
+        slab_header *slot = (slab_header *)(slab + j*pool->slot_size);
+        slot->index = (uint32_t)(k*SLAB_OBJECTS + j);
+        free_push(pool, slot);
+    }
+
+    return 0;
+}
+
+int slab_reserve(slab_pool *pool, int num_objects) {
+    int slabs_needed = (num_objects + SLAB_OBJECTS - 1)/SLAB_OBJECTS;
+
+    if (pool == NULL) return -1;
+
+    while (atomic_load(&pool->num_slabs) < slabs_needed)
+        if (slab_grow(pool) == -1) return -1;
+
+    return 0;
+}
+
+void *slab_alloc(slab_pool *pool) {
+    slab_header *slot = NULL;
+
+    if (pool == NULL) return NULL;
+
+    while ((slot = free_pop(pool)) == NULL)
+        if (slab_grow(pool) == -1) return NULL;
+
+    return (char *)slot + SLAB_HEADER;
+}
+
+void slab_free(slab_pool *pool, void *obj) {
+    if (pool == NULL || obj == NULL) return;
+
+    free_push(pool, (slab_header *)((char *)obj - SLAB_HEADER));
+}
+
+void slab_destroy(slab_pool *pool) {
+    int n = 0;
+
+    if (pool == NULL) return;
+
+    n = atomic_exchange(&pool->num_slabs, 0);
+    if (n > SLAB_MAX) n = SLAB_MAX;
+    for (int k = 0; k < n; k++) {
+        if (pool->slabs[k] != NULL) munmap(pool->slabs[k], SLAB_OBJECTS*pool->slot_size);
+        pool->slabs[k] = NULL;
+    }
+    atomic_store(&pool->free_head, 0);
+}
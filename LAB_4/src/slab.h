@@ -0,0 +1,77 @@
+/**
+ * @file slab.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos del reservador de
+ * objetos de tamaño fijo. Los objetos salen de slabs de SLAB_OBJECTS
+ * huecos reservados con mmap y los libres forman una pila lock-free,
+ * así que slab_alloc y slab_free se pueden llamar desde un manejador
+ * de señal y nunca usan malloc.
+ * @version 0.1 - Wallets copy-on-write.
+ * @date 2021-05-13
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#define SLAB_OBJECTS 1024
+#define SLAB_MAX 4096
+
+/* Cabecera de cada hueco, el objeto empieza justo después */
+#define SLAB_HEADER 16
+
+typedef struct {
+    size_t slot_size;
+    void *slabs[SLAB_MAX];
+    atomic_int num_slabs;
+    /* Cima de la pila de libres: (etiqueta << 32) | (índice+1) */
+    atomic_ulong free_head;
+} slab_pool;
+
+/* Inicializador estático de un pool de objetos del tipo type */
+#define SLAB_POOL_INIT(type) { .slot_size = SLAB_HEADER + ((sizeof(type) + 15) & ~(size_t)15) }
+
+/**
+ * @brief Función que reserva de antemano los slabs necesarios
+ * para num_objects objetos.
+ *
+ * @param pool Pool.
+ * @param num_objects Número de objetos.
+ * @return int 0 OK, -1 ERR.
+ */
+int slab_reserve(slab_pool *pool, int num_objects);
+
+/**
+ * @brief Función que saca un objeto libre del pool. Si no quedan,
+ * reserva otro slab con mmap. El contenido del objeto no se inicializa.
+ *
+ * @param pool Pool.
+ * @return void* Objeto, NULL si ERR.
+ */
+void *slab_alloc(slab_pool *pool);
+
+/**
+ * @brief Función que devuelve un objeto al pool.
+ *
+ * @param pool Pool del que salió.
+ * @param obj Objeto.
+ */
+void slab_free(slab_pool *pool, void *obj);
+
+/**
+ * @brief Función que libera todos los slabs. Los objetos que
+ * aún estén en uso dejan de ser válidos.
+ *
+ * @param pool Pool.
+ */
+void slab_destroy(slab_pool *pool);
+
+#endif
@@ -7,39 +7,682 @@
  * @version 0.1 - Minero paralelo.
  *          0.2 - Implementación bloques.
  *          0.3 - Memoria compartida bloques.
+ *          0.4 - Pool de trabajadores persistente.
+ *          0.5 - Búsqueda vectorizada.
+ *          0.6 - Reparto dinámico por trozos.
+ *          0.7 - Cancelación atómica y estado por línea de caché.
+ *          0.8 - Número de trabajadores automático.
+ *          0.9 - Afinidad de CPU y reparto por nodos NUMA.
+ *          1.0 - Progreso reanudable por target.
+ *          1.1 - Prueba de trabajo intercambiable.
  * @date 2021-04-27
  * 
  * @copyright Copyright (c) 2021
  * 
  */
 #include "trabajador.h"
+#include "pow.h"
 
-int solution_find = 0;
+atomic_int solution_find = 0;
+
+/* Incremento del hash al avanzar un candidato: h(n+1) = h(n) + STEP_X (mod PRIME) */
+#define STEP_X (BIG_X % PRIME)
 
 long int simple_hash(long int number) {
     long int result = (number * BIG_X + BIG_Y) % PRIME;
     return result;
 }
 
+/**
+ * @brief Función que calcula (a + b) mod PRIME sabiendo que
+ * a y b ya están reducidos. Evita la división del operador %.
+ * 
+ * @param a Primer sumando.
+ * @param b Segundo sumando.
+ * @return long int Suma reducida.
+ */
+static inline long int add_mod(long int a, long int b) {
+    long int r = a + b;
+    return r >= PRIME ? r - PRIME : r;
+}
+
+/**
+ * @brief Kernel escalar. Recorre el rango calculando el hash de
+ * forma incremental (suma y resta condicional) en lugar de usar %.
+ * 
+ * @param start Primer candidato.
+ * @param end Último candidato (no incluido).
+ * @param target Hash buscado.
+ * @return long int Candidato cuyo hash es target, -1 si no está en el rango.
+ */
+static long int search_scalar(long int start, long int end, long int target) {
+    long int h = 0, i = start, stop = 0;
+
+    if (start >= end) return -1;
+    h = simple_hash(start);
+
+    while (i < end) {
+        if (CANCELLED()) return -1;
+
+        stop = i + CANCEL_POLL < end ? i + CANCEL_POLL : end;
+        for (; i < stop; i++) {
+            if (h == target) return i;
+            h = add_mod(h, STEP_X);
+        }
+    }
+
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Los kernels vectoriales trabajan con 4 vectores independientes por
+iteración. Todos los hashes son menores que PRIME < 2^27, por lo que
+caben en enteros de 32 bits con signo y la resta condicional se puede
+hacer con comparaciones con signo (SSE2) o con min sin signo, ya que
+h - PRIME da la vuelta cuando h < PRIME. */
+#define UNROLL 4
+
+/**
+ * @brief Kernel SSE2, 4 candidatos por vector.
+ * 
+ * @param start Primer candidato.
+ * @param end Último candidato (no incluido).
+ * @param target Hash buscado.
+ * @return long int Candidato cuyo hash es target, -1 si no está en el rango.
+ */
+__attribute__((target("sse2")))
+static long int search_sse2(long int start, long int end, long int target) {
+    const int lanes = 4, width = 4*UNROLL;
+    long int i = start, stop = 0, h = 0;
+    __m128i v[UNROLL];
+
+    if (start >= end) return -1;
+    if (target < 0 || target >= PRIME) return search_scalar(start, end, target);
+
+    /* v[j] contiene los hashes de start + j*lanes + lane */
+    h = simple_hash(start);
+    for (int j = 0; j < UNROLL; j++) {
+        int tmp[4];
+        for (int l = 0; l < lanes; l++) {
+            tmp[l] = (int)h;
+            h = add_mod(h, STEP_X);
+        }
+        v[j] = _mm_loadu_si128((__m128i *)tmp);
+    }
+
+    const __m128i step = _mm_set1_epi32((int)((long int)width*BIG_X % PRIME));
+    const __m128i prime = _mm_set1_epi32(PRIME);
+    const __m128i prime_1 = _mm_set1_epi32(PRIME-1);
+    const __m128i t = _mm_set1_epi32((int)target);
+
+    while (end - i >= width) {
+        if (CANCELLED()) return -1;
+
+        stop = i + CANCEL_POLL < end ? i + CANCEL_POLL : end;
+        for (; stop - i >= width; i += width) {
+            int mask = 0;
+            for (int j = 0; j < UNROLL; j++)
+                mask |= _mm_movemask_epi8(_mm_cmpeq_epi32(v[j], t));
+
+            if (mask != 0) {
+                /* Lo buscamos de forma escalar dentro del grupo */
+                return search_scalar(i, i + width, target);
+            }
+
+            for (int j = 0; j < UNROLL; j++) {
+                __m128i x = _mm_add_epi32(v[j], step);
+                v[j] = _mm_sub_epi32(x, _mm_and_si128(_mm_cmpgt_epi32(x, prime_1), prime));
+            }
+        }
+    }
+
+    return search_scalar(i, end, target);
+}
+
+/**
+ * @brief Kernel AVX2, 8 candidatos por vector.
+ * 
+ * @param start Primer candidato.
+ * @param end Último candidato (no incluido).
+ * @param target Hash buscado.
+ * @return long int Candidato cuyo hash es target, -1 si no está en el rango.
+ */
+__attribute__((target("avx2")))
+static long int search_avx2(long int start, long int end, long int target) {
+    const int lanes = 8, width = 8*UNROLL;
+    long int i = start, stop = 0, h = 0;
+    __m256i v[UNROLL];
+
+    if (start >= end) return -1;
+    if (target < 0 || target >= PRIME) return search_scalar(start, end, target);
+
+    h = simple_hash(start);
+    for (int j = 0; j < UNROLL; j++) {
+        int tmp[8];
+        for (int l = 0; l < lanes; l++) {
+            tmp[l] = (int)h;
+            h = add_mod(h, STEP_X);
+        }
+        v[j] = _mm256_loadu_si256((__m256i *)tmp);
+    }
+
+    const __m256i step = _mm256_set1_epi32((int)((long int)width*BIG_X % PRIME));
+    const __m256i prime = _mm256_set1_epi32(PRIME);
+    const __m256i t = _mm256_set1_epi32((int)target);
+
+    while (end - i >= width) {
+        if (CANCELLED()) return -1;
+
+        stop = i + CANCEL_POLL < end ? i + CANCEL_POLL : end;
+        for (; stop - i >= width; i += width) {
+            __m256i eq = _mm256_cmpeq_epi32(v[0], t);
+            for (int j = 1; j < UNROLL; j++)
+                eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(v[j], t));
+
+            if (_mm256_testz_si256(eq, eq) == 0)
+                return search_scalar(i, i + width, target);
+
+            for (int j = 0; j < UNROLL; j++) {
+                __m256i x = _mm256_add_epi32(v[j], step);
+                v[j] = _mm256_min_epu32(x, _mm256_sub_epi32(x, prime));
+            }
+        }
+    }
+
+    return search_scalar(i, end, target);
+}
+
+/**
+ * @brief Kernel AVX-512, 16 candidatos por vector.
+ * 
+ * @param start Primer candidato.
+ * @param end Último candidato (no incluido).
+ * @param target Hash buscado.
+ * @return long int Candidato cuyo hash es target, -1 si no está en el rango.
+ */
+__attribute__((target("avx512f")))
+static long int search_avx512(long int start, long int end, long int target) {
+    const int lanes = 16, width = 16*UNROLL;
+    long int i = start, stop = 0, h = 0;
+    __m512i v[UNROLL];
+
+    if (start >= end) return -1;
+    if (target < 0 || target >= PRIME) return search_scalar(start, end, target);
+
+    h = simple_hash(start);
+    for (int j = 0; j < UNROLL; j++) {
+        int tmp[16];
+        for (int l = 0; l < lanes; l++) {
+            tmp[l] = (int)h;
+            h = add_mod(h, STEP_X);
+        }
+        v[j] = _mm512_loadu_si512((void *)tmp);
+    }
+
+    const __m512i step = _mm512_set1_epi32((int)((long int)width*BIG_X % PRIME));
+    const __m512i prime = _mm512_set1_epi32(PRIME);
+    const __m512i t = _mm512_set1_epi32((int)target);
+
+    while (end - i >= width) {
+        if (CANCELLED()) return -1;
+
+        stop = i + CANCEL_POLL < end ? i + CANCEL_POLL : end;
+        for (; stop - i >= width; i += width) {
+            __mmask16 eq = 0;
+            for (int j = 0; j < UNROLL; j++)
+                eq |= _mm512_cmpeq_epi32_mask(v[j], t);
+
+            if (eq != 0)
+                return search_scalar(i, i + width, target);
+
+            for (int j = 0; j < UNROLL; j++) {
+                __m512i x = _mm512_add_epi32(v[j], step);
+                v[j] = _mm512_min_epu32(x, _mm512_sub_epi32(x, prime));
+            }
+        }
+    }
+
+    return search_scalar(i, end, target);
+}
+
+#endif
+
+static const search_kernel kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", 16, search_avx512},
+    {"avx2", 8, search_avx2},
+    {"sse2", 4, search_sse2},
+#endif
+    {"scalar", 1, search_scalar}
+};
+
+static const search_kernel *selected_kernel = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Elige el mejor kernel que soporta la CPU.
+ */
+static void select_kernel() {
+    int n = sizeof(kernels)/sizeof(kernels[0]);
+
+    selected_kernel = &kernels[n-1];
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) selected_kernel = &kernels[0];
+    else if (__builtin_cpu_supports("avx2")) selected_kernel = &kernels[1];
+    else if (__builtin_cpu_supports("sse2")) selected_kernel = &kernels[2];
+#endif
+}
+
+const search_kernel *search_kernel_get() {
+    pthread_once(&kernel_once, select_kernel);
+    return selected_kernel;
+}
+
+const search_kernel *search_kernel_list(int *n) {
+    int total = sizeof(kernels)/sizeof(kernels[0]);
+    const search_kernel *best = search_kernel_get();
+
+    /* Los kernels están ordenados, así que los soportados son
+    el elegido y todos los que van detrás */
+    if (n != NULL) *n = total - (int)(best - kernels);
+    return best;
+}
+
+/* Bits por palabra del bitmap de progreso */
+#define WORD_BITS (8*sizeof(unsigned long))
+
+void sched_ini(range_scheduler *sched) {
+    if (sched == NULL) return;
+
+    atomic_store(&sched->cursor, 0);
+    sched->end = 0;
+    sched->chunk = DEFAULT_CHUNK;
+    sched->target = -1;
+    sched->num_words = 0;
+    sched->done = NULL;
+}
+
+int sched_reset(range_scheduler *sched, long int target, long int end, long int chunk) {
+    long int words = 0;
+
+    if (sched == NULL) return -1;
+    if (chunk <= 0) chunk = DEFAULT_CHUNK;
+
+    words = ((end + chunk - 1)/chunk + WORD_BITS - 1)/WORD_BITS;
+
+    /* Mismo target y mismos trozos: conservamos el progreso */
+    if (target != sched->target || end != sched->end || chunk != sched->chunk || sched->done == NULL) {
+        if (words != sched->num_words || sched->done == NULL) {
+            free(sched->done);
+            sched->done = (atomic_ulong *)malloc(words*sizeof(atomic_ulong));
+            if (sched->done == NULL) {
+                perror("malloc");
+                sched->num_words = 0;
+                sched->target = -1;
+                return -1;
+            }
+            sched->num_words = words;
+        }
+        for (long int w = 0; w < words; w++) atomic_init(&sched->done[w], 0);
+    }
+
+    sched->target = target;
+    sched->end = end;
+    sched->chunk = chunk;
+    atomic_store(&sched->cursor, 0);
+
+    return 0;
+}
+
+void sched_forget(range_scheduler *sched) {
+    if (sched == NULL) return;
+    sched->target = -1;
+}
+
+void sched_free(range_scheduler *sched) {
+    if (sched == NULL) return;
+
+    free(sched->done);
+    sched->done = NULL;
+    sched->num_words = 0;
+    sched->target = -1;
+}
+
+int sched_claim(range_scheduler *sched, long int *start, long int *stop) {
+    long int first = 0, c = 0;
+
+    if (sched == NULL || start == NULL || stop == NULL) return 0;
+
+    while (1) {
+        /* Cortocircuito para no seguir sumando al cursor cuando ya se ha acabado */
+        if (atomic_load_explicit(&sched->cursor, memory_order_relaxed) >= sched->end) return 0;
+
+        first = atomic_fetch_add_explicit(&sched->cursor, sched->chunk, memory_order_relaxed);
+        if (first >= sched->end) return 0;
+
+        /* Saltamos los trozos que ya se recorrieron en un intento anterior */
+        c = first/sched->chunk;
+        if (sched->done != NULL
+            && (atomic_load_explicit(&sched->done[c/WORD_BITS], memory_order_relaxed) & (1UL << (c % WORD_BITS))) != 0)
+            continue;
+
+        *start = first;
+        *stop = first + sched->chunk < sched->end ? first + sched->chunk : sched->end;
+        return 1;
+    }
+}
+
+void sched_complete(range_scheduler *sched, long int start) {
+    long int c = 0;
+
+    if (sched == NULL || sched->done == NULL) return;
+
+    c = start/sched->chunk;
+    atomic_fetch_or_explicit(&sched->done[c/WORD_BITS], 1UL << (c % WORD_BITS), memory_order_relaxed);
+}
+
 void *work_thread(void *arg) {
+    long int solution = -1, start = 0, stop = 0;
+
     if (arg == NULL) {
         fprintf(stderr, "Error en work_thread. Null recibido.\n");
         return NULL;
     }
 
     worker_struct *indexes = (worker_struct *)arg;
-    long int i = indexes->starting_index;
+    const search_kernel *kernel = pow_get()->kernel_get();
 
     /* Buscando el target */
-    for (; i < indexes->ending_index; i++) {
-        if (solution_find != 0) break;
+    if (indexes->sched == NULL) {
+        solution = kernel->search(indexes->starting_index, indexes->ending_index, indexes->target);
+    } else {
+        while (solution == -1 && !CANCELLED() && sched_claim(indexes->sched, &start, &stop) == 1) {
+            solution = kernel->search(start, stop, indexes->target);
 
-        if (indexes->target == simple_hash(i)) {
-            indexes->solution =  i;
-            solution_find = 1;
-            return NULL;
+            /* Si no se ha cancelado, el trozo se ha recorrido entero */
+            if (solution == -1 && !CANCELLED()) sched_complete(indexes->sched, start);
         }
     }
 
+    if (solution != -1) {
+        indexes->solution = solution;
+        atomic_store_explicit(&solution_find, 1, memory_order_relaxed);
+    }
+
     return NULL;
 }
+
+/**
+ * @brief Función que lee una lista de CPUs de /sys con el formato
+ * "0-3,8,10-11" y añade al conjunto las que estén en allowed.
+ * 
+ * @param path Fichero a leer.
+ * @param allowed CPUs permitidas.
+ * @param set Conjunto donde añadirlas.
+ * @return int 0 OK, -1 ERR.
+ */
+static int read_cpulist(const char *path, cpu_set_t *allowed, cpu_set_t *set) {
+    char buf[4096], *p = NULL;
+    FILE *pf = NULL;
+
+    pf = fopen(path, "r");
+    if (pf == NULL) return -1;
+    if (fgets(buf, sizeof(buf), pf) == NULL) {
+        fclose(pf);
+        return -1;
+    }
+    fclose(pf);
+
+    p = buf;
+    while (*p != '\0' && *p != '\n') {
+        long int first = strtol(p, &p, 10), last = first;
+        if (*p == '-') last = strtol(p+1, &p, 10);
+        for (long int c = first; c <= last && c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, allowed)) CPU_SET(c, set);
+        if (*p == ',') p++;
+        else break;
+    }
+
+    return 0;
+}
+
+int *cpu_plan(int num_workers, int offset) {
+    cpu_set_t allowed, nodes[64];
+    int num_nodes = 0, total = 0, *order = NULL, *plan = NULL, k = 0;
+    char path[128];
+
+    if (num_workers <= 0) return NULL;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) {
+        perror("sched_getaffinity");
+        return NULL;
+    }
+
+    /* Agrupamos las CPUs permitidas por nodo */
+    for (int n = 0; n < 64; n++) {
+        CPU_ZERO(&nodes[num_nodes]);
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", n);
+        if (read_cpulist(path, &allowed, &nodes[num_nodes]) == -1) continue;
+        if (CPU_COUNT(&nodes[num_nodes]) > 0) num_nodes++;
+    }
+
+    /* Sin información NUMA hay un único nodo */
+    if (num_nodes == 0) {
+        nodes[0] = allowed;
+        num_nodes = 1;
+    }
+
+    total = CPU_COUNT(&allowed);
+    order = (int *)malloc(total*sizeof(int));
+    plan = (int *)malloc(num_workers*sizeof(int));
+    if (order == NULL || plan == NULL) {
+        perror("malloc");
+        free(order);
+        free(plan);
+        return NULL;
+    }
+
+    /* Orden de reparto: la primera CPU de cada nodo, luego la segunda... */
+    int next[64] = {0};
+    while (k < total) {
+        short added = 0;
+        for (int n = 0; n < num_nodes && k < total; n++) {
+            for (int c = next[n]; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &nodes[n])) {
+                    order[k++] = c;
+                    next[n] = c+1;
+                    added = 1;
+                    break;
+                }
+            }
+        }
+        /* Las CPUs que no aparecen en ningún nodo no se usan */
+        if (added == 0) break;
+    }
+
+    if (k == 0) {
+        free(order);
+        free(plan);
+        return NULL;
+    }
+
+    if (offset < 0) offset = 0;
+    for (int i = 0; i < num_workers; i++) plan[i] = order[(offset + i) % k];
+
+    free(order);
+    return plan;
+}
+
+/**
+ * @brief Bucle de cada hilo del pool. Espera a que se publique
+ * una ronda, ejecuta su trabajo y avisa al terminar.
+ * 
+ * @param arg pool_slot del hilo.
+ * @return void* NULL
+ */
+static void *pool_thread(void *arg) {
+    pool_slot *slot = (pool_slot *)arg;
+    worker_pool *pool = slot->pool;
+    worker_struct *local = NULL;
+    long int seen_round = 0;
+
+    /* Primero nos fijamos a la CPU y después reservamos el estado,
+    para que las páginas se asignen en la memoria de nuestro nodo */
+    if (pool->cpus != NULL) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pool->cpus[slot->id], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0)
+            fprintf(stderr, "No se ha podido fijar el trabajador %d a la CPU %d.\n", slot->id, pool->cpus[slot->id]);
+    }
+
+    local = (worker_struct *)aligned_alloc(CACHE_LINE, sizeof(worker_struct));
+    if (local != NULL) memset(local, 0, sizeof(worker_struct));
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        /* Esperamos a que haya una ronda nueva */
+        while (pool->round == seen_round && pool->shutdown == 0)
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        if (pool->shutdown == 1) break;
+
+        seen_round = pool->round;
+        worker_struct *job = &pool->jobs[slot->id];
+        pthread_mutex_unlock(&pool->mutex);
+
+        /* Trabajamos sobre la copia local y devolvemos el resultado */
+        if (local != NULL) {
+            *local = *job;
+            work_thread((void *)local);
+            job->solution = local->solution;
+        } else work_thread((void *)job);
+
+        /* El último en terminar despierta al minero */
+        pthread_mutex_lock(&pool->mutex);
+        pool->pending -= 1;
+        if (pool->pending == 0) pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    free(local);
+
+    return NULL;
+}
+
+int workers_available() {
+    cpu_set_t set;
+    long int n = 0;
+
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == 0) n = CPU_COUNT(&set);
+    if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0) n = 1;
+
+    return (int)n;
+}
+
+worker_pool *pool_ini(int num_workers, const int *cpus) {
+    worker_pool *pool = NULL;
+    sigset_t all, old;
+    int err = 0, i = 0;
+
+    if (num_workers <= 0) return NULL;
+
+    pool = (worker_pool *)calloc(1, sizeof(worker_pool));
+    if (pool == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+
+    pool->threads = (pthread_t *)malloc(num_workers*sizeof(pthread_t));
+    pool->slots = (pool_slot *)aligned_alloc(CACHE_LINE, num_workers*sizeof(pool_slot));
+    if (cpus != NULL) pool->cpus = (int *)malloc(num_workers*sizeof(int));
+    if (pool->threads == NULL || pool->slots == NULL || (cpus != NULL && pool->cpus == NULL)) {
+        perror("malloc");
+        free(pool->threads);
+        free(pool->slots);
+        free(pool->cpus);
+        free(pool);
+        return NULL;
+    }
+    if (cpus != NULL) memcpy(pool->cpus, cpus, num_workers*sizeof(int));
+
+    pool->num_workers = num_workers;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* Los hilos heredan la máscara, así que bloqueamos todas las
+    señales mientras los creamos */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for (i = 0; i < num_workers; i++) {
+        pool->slots[i].pool = pool;
+        pool->slots[i].id = i;
+        err = pthread_create(&pool->threads[i], NULL, pool_thread, (void *)&pool->slots[i]);
+        if (err != 0) break;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        fprintf(stderr, "Error creando threads. pthread_create: %s\n", strerror(err));
+        /* Terminamos los hilos que sí se han creado */
+        pool->num_workers = i;
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int pool_start(worker_pool *pool, worker_struct *jobs) {
+    if (pool == NULL || jobs == NULL) return -1;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->jobs = jobs;
+    pool->pending = pool->num_workers;
+    pool->round += 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return 0;
+}
+
+int pool_wait(worker_pool *pool) {
+    if (pool == NULL) return -1;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return 0;
+}
+
+void pool_destroy(worker_pool *pool) {
+    if (pool == NULL) return;
+
+    /* Si hay una ronda en marcha hacemos que acabe cuanto antes */
+    atomic_store(&solution_find, 1);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->num_workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->slots);
+    free(pool->cpus);
+    free(pool);
+}
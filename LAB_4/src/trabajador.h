@@ -7,6 +7,14 @@
  * @version 0.1 - Minero paralelo.
  *          0.2 - Implementación bloques.
  *          0.3 - Memoria compartida bloques.
+ *          0.4 - Pool de trabajadores persistente.
+ *          0.5 - Búsqueda vectorizada.
+ *          0.6 - Reparto dinámico por trozos.
+ *          0.7 - Cancelación atómica y estado por línea de caché.
+ *          0.8 - Número de trabajadores automático.
+ *          0.9 - Afinidad de CPU y reparto por nodos NUMA.
+ *          1.0 - Progreso reanudable por target.
+ *          1.1 - Prueba de trabajo intercambiable.
  * @date 2021-04-27
  * 
  * @copyright Copyright (c) 2021
@@ -15,21 +23,113 @@
 #ifndef TRABAJADOR_H
 #define TRABAJADOR_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <unistd.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define PRIME 99997669
 #define BIG_X 435679812
 #define BIG_Y 100001819
 
+/* Tamaño por defecto de los trozos que reclaman los trabajadores */
+#define DEFAULT_CHUNK (1 << 16)
+
+/* Tamaño de línea de caché. Cada trabajador tiene su estado en una
+línea distinta para que no haya false sharing entre ellos. */
+#define CACHE_LINE 64
+
+/* Los trabajadores leen el token de cancelación (solution_find) una vez
+cada CANCEL_POLL candidatos y al reclamar cada trozo, nunca en cada hash.
+Una vez se escribe el token (al encontrar la solución o desde los
+manejadores de SIGINT y SIGUSR2), cada trabajador comprueba como mucho
+CANCEL_POLL + 64 candidatos más antes de parar: unos 25 us con el kernel
+escalar y menos de 5 us con AVX2/AVX-512. */
+#define CANCEL_POLL (1 << 14)
+
+/* Token de cancelación de la ronda. Es atómico y lock-free, por lo que
+se puede escribir desde un manejador de señal. */
+extern atomic_int solution_find;
+
+/**
+ * @brief Consulta del token de cancelación. La carga es relaxed porque
+ * solo nos importa ver el cambio tarde o temprano, no ordenar otros
+ * accesos a memoria con él.
+ */
+#define CANCELLED() (atomic_load_explicit(&solution_find, memory_order_relaxed) != 0)
+
+/* Planificador de rangos compartido por los trabajadores de una ronda.
+Cada trabajador reclama con un fetch_add el trozo [cursor, cursor+chunk),
+así los trozos son disjuntos y cubren [0, end) entero, y los hilos
+más rápidos simplemente reclaman más trozos.
+Además guarda en un bitmap (un bit por trozo) qué trozos del target
+actual se han recorrido enteros sin encontrar la solución. Si la
+siguiente ronda es del mismo target (la votación ha rechazado el
+bloque o la ronda se ha interrumpido) esos trozos se saltan. */
 typedef struct {
-    int starting_index;
-    int ending_index;
+    _Alignas(CACHE_LINE) atomic_long cursor;
+    _Alignas(CACHE_LINE) long int end;
+    long int chunk;
+    long int target;
+    long int num_words;
+    atomic_ulong *done;
+} range_scheduler;
+
+/* Si sched es NULL el trabajador recorre el rango fijo
+[starting_index, ending_index). Ocupa una línea de caché entera, por lo
+que un array de worker_struct debe reservarse alineado a CACHE_LINE. */
+typedef struct {
+    _Alignas(CACHE_LINE) long int starting_index;
+    long int ending_index;
     long int target;
     long int solution;
+    range_scheduler *sched;
 } worker_struct;
 
+/* Kernel de búsqueda. Devuelve el candidato de [start, end) cuyo
+hash es target o -1 si no está o si se ha activado solution_find. */
+typedef struct {
+    const char *name;
+    int lanes;
+    long int (*search)(long int start, long int end, long int target);
+} search_kernel;
+
+struct _worker_pool;
+
+typedef struct {
+    _Alignas(CACHE_LINE) struct _worker_pool *pool;
+    int id;
+} pool_slot;
+
+/* Pool de hilos que se mantienen vivos entre rondas. Los hilos
+esperan en la condición start hasta que se publica una ronda nueva
+(round cambia) y avisan por done cuando han terminado su trabajo.
+Si cpus no es NULL el hilo i se fija a la CPU cpus[i]. */
+typedef struct _worker_pool {
+    pthread_t *threads;
+    pool_slot *slots;
+    int *cpus;
+    worker_struct *jobs;
+    int num_workers;
+    int pending;
+    long int round;
+    short shutdown;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+} worker_pool;
+
 /**
  * @brief Función que calcula un resultado dada una entrada.
  * 
@@ -38,12 +138,153 @@ typedef struct {
  */
 long int simple_hash(long int number);
 
+/**
+ * @brief Función que inicializa un planificador vacío.
+ * 
+ * @param sched Planificador.
+ */
+void sched_ini(range_scheduler *sched);
+
+/**
+ * @brief Función que prepara el planificador para una ronda
+ * nueva sobre el dominio [0, end). Si el target, el dominio y el
+ * tamaño de trozo son los de la ronda anterior se conserva el
+ * progreso y los trozos ya recorridos no se vuelven a repartir.
+ * 
+ * @param sched Planificador.
+ * @param target Target de la ronda.
+ * @param end Fin del dominio (no incluido).
+ * @param chunk Tamaño de trozo, si es <= 0 se usa DEFAULT_CHUNK.
+ * @return int 0 OK, -1 ERR.
+ */
+int sched_reset(range_scheduler *sched, long int target, long int end, long int chunk);
+
+/**
+ * @brief Función que olvida el progreso guardado, para que la
+ * siguiente ronda recorra el dominio entero aunque sea del mismo target.
+ * 
+ * @param sched Planificador.
+ */
+void sched_forget(range_scheduler *sched);
+
+/**
+ * @brief Función que libera la memoria del planificador.
+ * 
+ * @param sched Planificador.
+ */
+void sched_free(range_scheduler *sched);
+
+/**
+ * @brief Función que reclama el siguiente trozo sin procesar.
+ * 
+ * @param sched Planificador.
+ * @param start Inicio del trozo reclamado.
+ * @param stop Fin del trozo reclamado (no incluido).
+ * @return int 1 si se ha reclamado un trozo, 0 si no quedan.
+ */
+int sched_claim(range_scheduler *sched, long int *start, long int *stop);
+
+/**
+ * @brief Función que marca un trozo como recorrido entero sin
+ * encontrar la solución.
+ * 
+ * @param sched Planificador.
+ * @param start Inicio del trozo (el devuelto por sched_claim).
+ */
+void sched_complete(range_scheduler *sched, long int start);
+
+/**
+ * @brief Función que devuelve el kernel de búsqueda más rápido
+ * soportado por la CPU (AVX-512, AVX2, SSE2 o escalar). Se elige
+ * una única vez, la primera vez que se llama.
+ * 
+ * @return const search_kernel* Kernel elegido.
+ */
+const search_kernel *search_kernel_get();
+
+/**
+ * @brief Función que devuelve todos los kernels que soporta la CPU,
+ * del más rápido al más lento (el último siempre es el escalar).
+ * 
+ * @param n Donde se guarda el número de kernels.
+ * @return const search_kernel* Array de kernels.
+ */
+const search_kernel *search_kernel_list(int *n);
+
 /**
  * @brief Función diseñada para que sea ejecutada por un hilo.
+ * Busca con el kernel del puzzle activo (ver pow.h).
  * 
  * @param arg Estructura
  * @return void* NULL
  */
 void *work_thread(void *arg);
 
+/**
+ * @brief Función que devuelve el número de CPUs en las que puede
+ * ejecutarse el proceso. Usa la máscara de afinidad (respeta taskset
+ * y cgroups) y si falla el número de CPUs en línea.
+ * 
+ * @return int Número de CPUs, al menos 1.
+ */
+int workers_available();
+
+/**
+ * @brief Función que calcula a qué CPU fijar cada trabajador.
+ * Agrupa las CPUs permitidas por nodo NUMA (según /sys) y reparte
+ * los trabajadores entre nodos de forma alterna, para usar la
+ * memoria y la caché de todos los sockets. El desplazamiento permite
+ * que varios mineros en la misma máquina empiecen en CPUs distintas
+ * en lugar de pelearse por las primeras.
+ * 
+ * @param num_workers Número de trabajadores.
+ * @param offset Posición en el reparto desde la que empezar.
+ * @return int* Array de num_workers CPUs (liberar con free), NULL si ERR.
+ */
+int *cpu_plan(int num_workers, int offset);
+
+/**
+ * @brief Función que crea un pool de trabajadores. Los hilos
+ * se crean una única vez y se quedan esperando a que se les
+ * asigne trabajo con pool_start. Los hilos del pool bloquean
+ * todas las señales, para que sea el hilo principal quien
+ * las reciba. Cada hilo reserva su propio worker_struct después
+ * de fijarse a su CPU, así la primera escritura lo deja en la
+ * memoria de su nodo NUMA.
+ * 
+ * @param num_workers Número de trabajadores.
+ * @param cpus CPU de cada trabajador (se copia), NULL para no fijarlos.
+ * @return worker_pool* Pool creado, NULL en caso de error.
+ */
+worker_pool *pool_ini(int num_workers, const int *cpus);
+
+/**
+ * @brief Función que reparte una ronda de trabajo al pool.
+ * El trabajador i ejecuta work_thread sobre jobs[i], por lo que
+ * jobs debe tener al menos num_workers elementos y no debe
+ * modificarse hasta que pool_wait retorne.
+ * 
+ * @param pool Pool de trabajadores.
+ * @param jobs Trabajos de la ronda.
+ * @return int 0 OK, -1 ERR.
+ */
+int pool_start(worker_pool *pool, worker_struct *jobs);
+
+/**
+ * @brief Función que espera a que todos los trabajadores del
+ * pool terminen la ronda actual.
+ * 
+ * @param pool Pool de trabajadores.
+ * @return int 0 OK, -1 ERR.
+ */
+int pool_wait(worker_pool *pool);
+
+/**
+ * @brief Función que termina los hilos del pool y libera
+ * sus recursos. Cancela la ronda que esté en marcha.
+ * 
+ * @param pool Pool a destruir.
+ */
+void pool_destroy(worker_pool *pool);
+
 #endif
\ No newline at end of file
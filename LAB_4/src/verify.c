@@ -0,0 +1,282 @@
+/**
+ * @file verify.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Programa que audita una cadena guardada en un almacén
+ * binario sin levantar la red. Comprueba de cada bloque la suma de
+ * control de la entrada, el puzzle (pow_verify), que su target sea
+ * la solución del anterior con id consecutivo y que el saldo de cada
+ * ganador suba de uno en uno entre sus bloques. Las entradas se
+ * reparten en trozos contiguos entre los hilos, cada hilo comprueba
+ * los pares de dentro de su trozo y al final se cosen en orden los
+ * pares de las fronteras y los saldos de cada ganador. Termina con 0
+ * si la cadena es correcta.
+ * @version 0.1 - Verificador paralelo de la cadena.
+ *          0.2 - Saldos del ganador en vez de todas las wallets.
+ * @date 2021-05-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <time.h>
+#include <string.h>
+
+#include "trabajador.h"
+#include "block.h"
+#include "pow.h"
+
+/* Tipos de error que se cuentan */
+#define ERR_ENTRY 0
+#define ERR_PUZZLE 1
+#define ERR_LINK 2
+#define ERR_WALLETS 3
+#define ERR_INVALID 4
+#define NUM_ERRS 5
+
+static const char *err_names[NUM_ERRS] = {"entrada corrupta", "puzzle", "enlace", "wallets", "no válido"};
+
+typedef struct {
+    const block_store *store;
+    long int start;
+    long int end;
+    long int errors[NUM_ERRS];
+    long int first_bad; /* Posición del primer error, -1 si no hay */
+
+    /* Por wallet: primer y último saldo cobrado en el trozo (0 si no
+    ha ganado ninguno) y posición del primero, para coser los trozos */
+    int *first_balance;
+    int *last_balance;
+    long int *first_pos;
+} verify_job;
+
+/**
+ * @brief Función que devuelve el tiempo actual en segundos.
+ *
+ * @return double Segundos (reloj monotónico).
+ */
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/**
+ * @brief Función que apunta un error del bloque en la posición pos.
+ */
+static void add_error(verify_job *job, int type, long int pos) {
+    job->errors[type]++;
+    if (job->first_bad == -1 || pos < job->first_bad) job->first_bad = pos;
+}
+
+/**
+ * @brief Función que comprueba un bloque por sí solo.
+ *
+ * @param job Trabajo donde se apuntan los errores.
+ * @param pos Posición del bloque.
+ * @param rec Bloque, NULL si la entrada está corrupta.
+ */
+static void check_block(verify_job *job, long int pos, const block_record *rec) {
+    if (rec == NULL) add_error(job, ERR_ENTRY, pos);
+    else if (rec->is_valid != 1) add_error(job, ERR_INVALID, pos);
+    else if (pow_verify(rec->target, rec->solution) != 1) add_error(job, ERR_PUZZLE, pos);
+}
+
+/**
+ * @brief Función que comprueba un bloque contra el anterior.
+ *
+ * @param job Trabajo donde se apuntan los errores.
+ * @param pos Posición del bloque.
+ * @param prev Bloque anterior.
+ * @param rec Bloque.
+ */
+static void check_link(verify_job *job, long int pos, const block_record *prev, const block_record *rec) {
+    if (rec->id != prev->id + 1 || rec->target != prev->solution) add_error(job, ERR_LINK, pos);
+}
+
+/**
+ * @brief Función que comprueba el saldo del ganador contra el de su
+ * último bloque ganado en el trozo: cada bloque le da una moneda.
+ *
+ * @param job Trabajo donde se apuntan los errores.
+ * @param pos Posición del bloque.
+ * @param rec Bloque válido.
+ */
+static void check_balance(verify_job *job, long int pos, const block_record *rec) {
+    int w = rec->winner;
+
+    if (w < 0 || w >= WALLET_MAX || rec->balance <= 0) {
+        add_error(job, ERR_WALLETS, pos);
+        return;
+    }
+
+    if (job->last_balance[w] == 0) {
+        job->first_balance[w] = rec->balance;
+        job->first_pos[w] = pos;
+    } else if (rec->balance != job->last_balance[w] + 1) add_error(job, ERR_WALLETS, pos);
+    job->last_balance[w] = rec->balance;
+}
+
+/**
+ * @brief Función que ejecuta cada hilo: comprueba las entradas
+ * [start, end) y los pares que caen dentro del trozo.
+ */
+static void *verify_thread(void *arg) {
+    verify_job *job = (verify_job *)arg;
+    const block_record *prev = NULL;
+
+    for (long int pos = job->start; pos < job->end; pos++) {
+        const block_record *rec = block_store_at(job->store, pos);
+
+        check_block(job, pos, rec);
+        if (rec != NULL && rec->is_valid == 1) check_balance(job, pos, rec);
+        if (prev != NULL && rec != NULL) check_link(job, pos, prev, rec);
+        prev = rec;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Función que libera los trabajos y sus arrays de saldos.
+ */
+static void free_jobs(verify_job *jobs, int num_threads) {
+    for (int i = 0; jobs != NULL && i < num_threads; i++) {
+        free(jobs[i].first_balance);
+        free(jobs[i].last_balance);
+        free(jobs[i].first_pos);
+    }
+    free(jobs);
+}
+
+int main(int argc, char *argv[]) {
+    int opt = 0, num_threads = 0, created = 0, err = 0;
+    int puzzle = POW_SIMPLE, difficulty = POW_DEFAULT_DIFFICULTY;
+    long int count = 0, total[NUM_ERRS] = {0}, first_bad = -1, bad = 0;
+    double t0 = 0, elapsed = 0;
+    block_store *store = NULL;
+    pthread_t *threads = NULL;
+    verify_job *jobs = NULL;
+    int *carry = NULL;
+
+    while ((opt = getopt(argc, argv, "t:p:d:")) != -1) {
+        switch (opt) {
+            case 't':
+                num_threads = strcmp(optarg, "auto") == 0 ? 0 : atoi(optarg);
+                break;
+            case 'p':
+                puzzle = pow_find(optarg);
+                break;
+            case 'd':
+                difficulty = atoi(optarg);
+                break;
+            default:
+                num_threads = -1;
+                break;
+        }
+    }
+
+    if (argc - optind != 1 || num_threads < 0 || puzzle == -1
+        || difficulty < POW_MIN_DIFFICULTY || difficulty > POW_MAX_DIFFICULTY) {
+        fprintf(stderr, "Usage: %s [-t HILOS|auto] [-p simple|sha256] [-d DIFICULTAD] <ALMACEN>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (num_threads == 0) num_threads = workers_available();
+
+    if (pow_select(puzzle, difficulty) == -1) {
+        fprintf(stderr, "Error seleccionando el puzzle.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    store = block_store_open(argv[optind], STORE_READ);
+    if (store == NULL) {
+        fprintf(stderr, "Error al abrir el almacén %s\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    count = block_store_count(store);
+    if (num_threads > count) num_threads = count > 0 ? count : 1;
+
+    threads = (pthread_t *)malloc(num_threads*sizeof(pthread_t));
+    jobs = (verify_job *)calloc(num_threads, sizeof(verify_job));
+    carry = (int *)calloc(WALLET_MAX, sizeof(int));
+    for (int i = 0; jobs != NULL && i < num_threads; i++) {
+        jobs[i].first_balance = (int *)calloc(WALLET_MAX, sizeof(int));
+        jobs[i].last_balance = (int *)calloc(WALLET_MAX, sizeof(int));
+        jobs[i].first_pos = (long int *)calloc(WALLET_MAX, sizeof(long int));
+        if (jobs[i].first_balance == NULL || jobs[i].last_balance == NULL || jobs[i].first_pos == NULL) err = -1;
+    }
+    if (threads == NULL || jobs == NULL || carry == NULL || err != 0) {
+        perror("malloc");
+        free_jobs(jobs, num_threads);
+        free(threads);
+        free(carry);
+        block_store_close(store);
+        exit(EXIT_FAILURE);
+    }
+
+    t0 = now();
+
+    /* Cada hilo comprueba un trozo contiguo de entradas */
+    for (int i = 0; i < num_threads; i++) {
+        jobs[i].store = store;
+        jobs[i].start = count*i/num_threads;
+        jobs[i].end = count*(i+1)/num_threads;
+        jobs[i].first_bad = -1;
+        err = pthread_create(&threads[i], NULL, verify_thread, (void *)&jobs[i]);
+        if (err != 0) {
+            fprintf(stderr, "Error creando threads. pthread_create: %s\n", strerror(err));
+            break;
+        }
+        created++;
+    }
+    for (int i = 0; i < created; i++) pthread_join(threads[i], NULL);
+
+    if (err != 0) {
+        free_jobs(jobs, num_threads);
+        free(threads);
+        free(carry);
+        block_store_close(store);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Cosemos las fronteras: el primero de cada trozo con el último del anterior */
+    for (int i = 1; i < num_threads; i++) {
+        const block_record *prev = block_store_at(store, jobs[i].start - 1);
+        const block_record *rec = block_store_at(store, jobs[i].start);
+
+        if (prev != NULL && rec != NULL && jobs[i].start < jobs[i].end) check_link(&jobs[i], jobs[i].start, prev, rec);
+    }
+
+    /* Cosemos los saldos: el primero de cada ganador en un trozo sigue
+    al último que cobró en los anteriores. Antes del primer bloque del
+    almacén no sabemos el saldo, así que ese no se comprueba */
+    for (int i = 0; i < num_threads; i++) {
+        for (int w = 0; w < WALLET_MAX; w++) {
+            if (jobs[i].last_balance[w] == 0) continue;
+            if (carry[w] != 0 && jobs[i].first_balance[w] != carry[w] + 1)
+                add_error(&jobs[i], ERR_WALLETS, jobs[i].first_pos[w]);
+            carry[w] = jobs[i].last_balance[w];
+        }
+    }
+
+    elapsed = now() - t0;
+
+    for (int i = 0; i < num_threads; i++) {
+        for (int k = 0; k < NUM_ERRS; k++) total[k] += jobs[i].errors[k];
+        if (jobs[i].first_bad != -1 && (first_bad == -1 || jobs[i].first_bad < first_bad)) first_bad = jobs[i].first_bad;
+    }
+
+    printf("Verificados %ld bloques con %d hilos en %.3f s (%.0f bloques/s), puzzle %s.\n",
+        count, num_threads, elapsed, elapsed > 0 ? count/elapsed : 0.0, pow_get()->name);
+    for (int k = 0; k < NUM_ERRS; k++) {
+        printf("\t%s: %ld\n", err_names[k], total[k]);
+        bad += total[k];
+    }
+    if (first_bad != -1) printf("Primer error en la entrada %ld.\n", first_bad);
+
+    free_jobs(jobs, num_threads);
+    free(threads);
+    free(carry);
+    block_store_close(store);
+
+    exit(bad == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,129 @@
+/**
+ * @file wire.c
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se codifica el formato de los mensajes
+ * que los mineros mandan al monitor.
+ * @version 0.1 - Formato compacto de los mensajes.
+ *          0.2 - Solo el ganador y su saldo, sin keyframes.
+ * @date 2021-05-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "wire.h"
+
+/**
+ * @brief Función que escribe un varint y devuelve los bytes usados.
+ */
+static int put_varint(unsigned char *buf, uint64_t value) {
+    int n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+
+    return n;
+}
+
+/**
+ * @brief Función que lee un varint de [*pos, len) y avanza *pos.
+ *
+ * @return int 0 OK, -1 si se acaba el mensaje o no cabe en 64 bits.
+ */
+static int get_varint(const unsigned char *buf, int len, int *pos, uint64_t *value) {
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos >= len) return -1;
+        *value |= (uint64_t)(buf[*pos] & 0x7F) << shift;
+        if ((buf[(*pos)++] & 0x80) == 0) return 0;
+    }
+
+    return -1;
+}
+
+/* Zigzag: los negativos pequeños (como -1) también ocupan un byte */
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+int wire_encode(const block_record *rec, unsigned char *buf) {
+    int n = 0;
+
+    if (rec == NULL || buf == NULL) return -1;
+
+    buf[n++] = WIRE_VERSION;
+    buf[n++] = 0;
+    n += put_varint(buf + n, (uint32_t)rec->id);
+    n += put_varint(buf + n, zigzag(rec->target));
+    n += put_varint(buf + n, zigzag(rec->solution));
+    n += put_varint(buf + n, zigzag(rec->is_valid));
+    n += put_varint(buf + n, zigzag(rec->winner));
+    n += put_varint(buf + n, zigzag(rec->balance));
+
+    return n;
+}
+
+int wire_decode(const unsigned char *buf, int len, block_record *rec) {
+    int pos = 2;
+    uint64_t id = 0, target = 0, solution = 0, is_valid = 0, winner = 0, balance = 0;
+
+    if (buf == NULL || rec == NULL || len < 2 || buf[0] != WIRE_VERSION) return -1;
+
+    if (get_varint(buf, len, &pos, &id) == -1
+        || get_varint(buf, len, &pos, &target) == -1
+        || get_varint(buf, len, &pos, &solution) == -1
+        || get_varint(buf, len, &pos, &is_valid) == -1
+        || get_varint(buf, len, &pos, &winner) == -1
+        || get_varint(buf, len, &pos, &balance) == -1) return -1;
+
+    rec->id = (int)id;
+    rec->target = unzigzag(target);
+    rec->solution = unzigzag(solution);
+    rec->is_valid = (int)unzigzag(is_valid);
+    rec->winner = (int)unzigzag(winner);
+    rec->balance = (int)unzigzag(balance);
+
+    /* Un ganador fuera de rango no se puede aplicar a las wallets */
+    if (rec->winner < -1 || rec->winner >= WALLET_MAX) return -1;
+
+    return pos == len ? 0 : -1;
+}
+
+mqd_t wire_queue_open(const char *name, int oflag) {
+    struct mq_attr attributes = {
+        .mq_flags = 0,
+        .mq_maxmsg = WIRE_QUEUE_MSGS,
+        .mq_curmsgs = 0,
+        .mq_msgsize = WIRE_MAX_SIZE
+    };
+    mqd_t queue = mq_open(name, oflag | O_CREAT, S_IRUSR | S_IWUSR, &attributes);
+
+    /* Sin privilegios la cola no puede pasar de fs.mqueue.msg_max mensajes */
+    if (queue == (mqd_t)-1 && (errno == EINVAL || errno == EMFILE || errno == ENOMEM)) {
+        attributes.mq_maxmsg = WIRE_QUEUE_MIN;
+        queue = mq_open(name, oflag | O_CREAT, S_IRUSR | S_IWUSR, &attributes);
+    }
+    if (queue == (mqd_t)-1) {
+        perror("mq_open");
+        return queue;
+    }
+
+    /* Una cola que ya existía puede ser de un formato anterior. Tiene
+    que ser del tamaño exacto: con mensajes mayores mq_receive falla
+    con EMSGSIZE al recibir en un buffer de WIRE_MAX_SIZE bytes */
+    if (mq_getattr(queue, &attributes) == -1 || attributes.mq_msgsize != WIRE_MAX_SIZE) {
+        fprintf(stderr, "La cola %s no es de mensajes de %d bytes, bórrela y vuelva a empezar.\n", name, WIRE_MAX_SIZE);
+        mq_close(queue);
+        return (mqd_t)-1;
+    }
+
+    return queue;
+}
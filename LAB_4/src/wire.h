@@ -0,0 +1,75 @@
+/**
+ * @file wire.h
+ * @author Kevin de la Coba Malam
+ *         Marcos Aarón Bernuy
+ * @brief Archivo donde se definen los prototipos del formato de los
+ * mensajes que los mineros mandan al monitor. Un mensaje lleva el id,
+ * target, solución y validez del bloque en varints, el ganador y su
+ * saldo nuevo. El resto de saldos no cambian, así que cada mensaje se
+ * entiende solo y el monitor puede engancharse en cualquier bloque.
+ *
+ * Formato (versión 2):
+ *      versión | flags | id | target | solución | is_valid | ganador | saldo
+ * Todo son varints salvo los dos primeros bytes. target, solución,
+ * is_valid, ganador y saldo van en zigzag.
+ * @version 0.1 - Formato compacto de los mensajes.
+ *          0.2 - Solo el ganador y su saldo, sin keyframes.
+ * @date 2021-05-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <mqueue.h>
+
+#include "block.h"
+
+#define WIRE_VERSION 2
+
+#define VARINT32_MAX 5
+#define VARINT64_MAX 10
+
+/* Tamaño del peor mensaje */
+#define WIRE_MAX_SIZE (2 + 4*VARINT32_MAX + 2*VARINT64_MAX)
+
+/* Mensajes que intentamos tener en vuelo en la cola. Si el sistema no
+deja tantos (fs.mqueue.msg_max) usamos WIRE_QUEUE_MIN */
+#define WIRE_QUEUE_MSGS 256
+#define WIRE_QUEUE_MIN 10
+
+/**
+ * @brief Función que codifica un bloque.
+ *
+ * @param rec Bloque a mandar.
+ * @param buf Buffer de al menos WIRE_MAX_SIZE bytes.
+ * @return int Bytes escritos, -1 si ERR.
+ */
+int wire_encode(const block_record *rec, unsigned char *buf);
+
+/**
+ * @brief Función que decodifica un mensaje.
+ *
+ * @param buf Mensaje.
+ * @param len Longitud del mensaje.
+ * @param rec Bloque donde se decodifica.
+ * @return int 0 OK, -1 si el mensaje está mal formado.
+ */
+int wire_decode(const unsigned char *buf, int len, block_record *rec);
+
+/**
+ * @brief Función que abre (o crea) la cola de mensajes al monitor con
+ * mensajes de WIRE_MAX_SIZE bytes.
+ *
+ * @param name Nombre de la cola.
+ * @param oflag Flags de mq_open, sin O_CREAT.
+ * @return mqd_t Cola, (mqd_t)-1 si ERR.
+ */
+mqd_t wire_queue_open(const char *name, int oflag);
+
+#endif